@@ -0,0 +1,411 @@
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <string>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+#include "hmm.h"
+#include "hmm_bank.h"
+#include "hmm_server.h"
+
+/**
+ * \note
+ * Standalone checks of the subtle parts which the command line runs do not cover.
+ * Every check prints its result, the exit code is non-zero if any check failed.
+ */
+
+/// symbols of all generated models, listed in this order so every model has the same symbol indices
+const char* CHECK_SYMBOLS[] = {"a", "b", "c", "d"};
+const size_t CHECK_NSYMBOLS = 4;
+
+/// relative tolerance of the log-likelihoods calculated by different summation orders
+const double CHECK_TOLERANCE = 1e-9;
+
+bool report(const std::string& name, bool passed, const std::string& details = std::string())
+{
+    std::cout << (passed ? "PASSED: " : "FAILED: ") << name;
+
+    if (! details.empty()) {
+        std::cout << " (" << details << ")";
+    }
+
+    std::cout << std::endl;
+
+    return passed;
+}
+
+bool closeEnough(double value, double expected)
+{
+    if (std::isinf(value) || std::isinf(expected)) {
+        return value == expected;
+    }
+
+    return std::fabs(value - expected) <= CHECK_TOLERANCE * std::max(1., std::fabs(expected));
+}
+
+/**
+ * \brief Random model with nhidden states between begin and end, some emissions are zero
+ *
+ * \param transitionScale transition rows sum to it, so models are not normalised unless it is one
+ */
+void generateModel(size_t nhidden, std::mt19937_64& engine, HMM::Data::Model& model, double transitionScale = 1.)
+{
+    std::uniform_real_distribution<double> uniform(0., 1.);
+    std::ostringstream text;
+    text.precision(17);
+
+    // section: states
+    text << nhidden + 2 << "\nB";
+
+    for (size_t i = 0; i < nhidden; ++i) {
+        text << " S" << i;
+    }
+
+    text << " E\n" << CHECK_NSYMBOLS << "\n";
+
+    // section: transitions, every hidden state may end the sequence
+    std::vector<std::string> lines;
+
+    for (size_t i = 0; i <= nhidden; ++i) {
+        std::string from = (i == 0 ? "B" : "S" + std::to_string(i - 1));
+        std::vector<double> weights(nhidden + 1);
+
+        for (size_t j = 0; j < weights.size(); ++j) {
+            weights[j] = uniform(engine);
+        }
+
+        // begin does not go to the end directly
+        if (i == 0) {
+            weights[nhidden] = 0;
+        }
+
+        double sum = std::accumulate(weights.begin(), weights.end(), 0.);
+
+        for (size_t j = 0; j < weights.size(); ++j) {
+            std::string to = (j == nhidden ? "E" : "S" + std::to_string(j));
+            std::ostringstream line;
+            line.precision(17);
+
+            if (weights[j] != 0) {
+                line << from << " " << to << " " << transitionScale * weights[j] / sum;
+                lines.push_back(line.str());
+            }
+        }
+    }
+
+    text << lines.size() << "\n";
+
+    for (size_t l = 0; l < lines.size(); ++l) {
+        text << lines[l] << "\n";
+    }
+
+    // section: emissions, a third of them are zero
+    text << nhidden * CHECK_NSYMBOLS << "\n";
+
+    for (size_t i = 0; i < nhidden; ++i) {
+        std::vector<double> weights(CHECK_NSYMBOLS);
+
+        for (size_t s = 0; s < CHECK_NSYMBOLS; ++s) {
+            weights[s] = (uniform(engine) < 1. / 3 ? 0. : uniform(engine));
+        }
+
+        weights[i % CHECK_NSYMBOLS] += 0.1;
+        double sum = std::accumulate(weights.begin(), weights.end(), 0.);
+
+        for (size_t s = 0; s < CHECK_NSYMBOLS; ++s) {
+            text << "S" << i << " " << CHECK_SYMBOLS[s] << " " << weights[s] / sum << "\n";
+        }
+    }
+
+    std::istringstream source(text.str());
+    model.ReadModel(source);
+}
+
+/**
+ * \brief Classify with zero margin picks the model of the largest exact log-likelihood
+ * and terminated models report bounds not below their exact log-likelihoods
+ *
+ * \param transitionScale above one the transition rows of the models sum to more than one
+ */
+bool checkModelBank(const std::string& name, double transitionScale)
+{
+    const size_t NTRIALS = 200;
+    const size_t NMODELS = 20;
+
+    std::mt19937_64 engine(20261017);
+    std::uniform_int_distribution<size_t> drawStates(1, 4);
+    std::uniform_int_distribution<size_t> drawLength(1, 120);
+    std::uniform_int_distribution<uint32_t> drawSymbol(0, CHECK_NSYMBOLS - 1);
+
+    bool bestPassed = true;
+    bool boundsPassed = true;
+    size_t nterminated = 0;
+    size_t nimpossible = 0;
+    HMM::Algorithms::Workspace workspace;
+
+    for (size_t trial = 0; trial < NTRIALS; ++trial) {
+        // section: bank of models of several sizes, some sizes take more than one batch
+        std::vector<HMM::Data::Model> models(NMODELS);
+        std::vector<HMM::Data::CompiledModel> compiledModels(NMODELS);
+        HMM::Bank::ModelBank bank(CHECK_NSYMBOLS);
+
+        for (size_t m = 0; m < NMODELS; ++m) {
+            generateModel(drawStates(engine), engine, models[m], transitionScale);
+            compiledModels[m].Compile(models[m]);
+            bank.Add(compiledModels[m]);
+        }
+
+        std::vector<uint32_t> sequence(drawLength(engine));
+
+        for (size_t t = 0; t < sequence.size(); ++t) {
+            sequence[t] = drawSymbol(engine);
+        }
+
+        HMM::Data::ColumnView symbols(sequence.data(), sequence.size(), sizeof(uint32_t), sizeof(uint32_t));
+
+        // section: exact log-likelihoods against the bank scores
+        std::vector<double> exact(NMODELS);
+        double bestExact = -std::numeric_limits<double>::infinity();
+
+        for (size_t m = 0; m < NMODELS; ++m) {
+            exact[m] = HMM::Algorithms::CalcLogLikelihood(compiledModels[m], symbols, workspace);
+            bestExact = std::max(bestExact, exact[m]);
+        }
+
+        std::vector<HMM::Bank::ModelScore> scores;
+        size_t best = bank.Classify(symbols, scores, 0);
+
+        if (std::isinf(bestExact)) {
+            ++nimpossible;
+            bestPassed = (best == bank.Size()) && bestPassed;
+        } else {
+            bestPassed = (best < bank.Size() && closeEnough(exact[best], bestExact) &&
+                          closeEnough(scores[best].logLikelihood, bestExact)) && bestPassed;
+        }
+
+        for (size_t m = 0; m < NMODELS; ++m) {
+            if (scores[m].terminated) {
+                ++nterminated;
+                boundsPassed = (scores[m].logLikelihood >= exact[m] ||
+                                closeEnough(scores[m].logLikelihood, exact[m])) && boundsPassed;
+            } else {
+                boundsPassed = closeEnough(scores[m].logLikelihood, exact[m]) && boundsPassed;
+            }
+        }
+    }
+
+    std::ostringstream details;
+    details << NTRIALS << " sequences, " << nimpossible << " impossible for all models";
+
+    std::ostringstream boundDetails;
+    boundDetails << nterminated << " terminated scores";
+
+    bool passed = report(name + " picks the model of the largest log-likelihood", bestPassed, details.str());
+    passed = report(name + " bounds of terminated models", boundsPassed && nterminated != 0,
+                    boundDetails.str()) && passed;
+
+    return passed;
+}
+
+/**
+ * \brief Version of the model registry holding only its name
+ */
+std::unique_ptr<const HMM::Server::ServedModel> registryVersion(size_t version)
+{
+    std::unique_ptr<HMM::Server::ServedModel> served(new HMM::Server::ServedModel());
+    served->name = "version " + std::to_string(version);
+
+    return std::unique_ptr<const HMM::Server::ServedModel>(served.release());
+}
+
+/**
+ * \brief A replaced version is kept while a guard which could see it is alive and deleted after that,
+ * readers running concurrently with publishing always see complete versions
+ */
+bool checkModelRegistry()
+{
+    typedef HMM::Server::ModelRegistry::ReadGuard ReadGuard;
+
+    // section: one guard holds the first version while the second one is published
+    HMM::Server::ModelRegistry registry(1, 2);
+    registry.Publish(0, registryVersion(1));
+
+    bool keptPassed = true;
+    bool reclaimedPassed = true;
+
+    {
+        ReadGuard holder(registry, 0);
+        const HMM::Server::ServedModel* held = holder.Get(0);
+
+        registry.Publish(0, registryVersion(2));
+        keptPassed = (registry.RetiredCount() == 1 && held->name == "version 1");
+
+        {
+            // a guard started after the swap sees the new version and does not release the old one
+            ReadGuard later(registry, 1);
+            keptPassed = (later.Get(0)->name == "version 2") && keptPassed;
+        }
+
+        keptPassed = (registry.RetiredCount() == 1 && held->name == "version 1") && keptPassed;
+    }
+
+    reclaimedPassed = (registry.RetiredCount() == 0);
+
+    // section: readers decode while versions are published
+    const size_t NREADERS = 4;
+    const size_t NVERSIONS = 2000;
+
+    HMM::Server::ModelRegistry sharedRegistry(1, NREADERS);
+    sharedRegistry.Publish(0, registryVersion(0));
+
+    std::atomic<bool> publishing(true);
+    std::atomic<bool> consistent(true);
+    std::vector<std::thread> readers;
+
+    for (size_t r = 0; r < NREADERS; ++r) {
+        readers.push_back(std::thread([&, r]()
+        {
+            while (publishing.load()) {
+                ReadGuard guard(sharedRegistry, r);
+                const HMM::Server::ServedModel* served = guard.Get(0);
+
+                if (served == 0 || served->name.compare(0, 8, "version ") != 0) {
+                    consistent.store(false);
+                }
+            }
+        }));
+    }
+
+    for (size_t v = 1; v <= NVERSIONS; ++v) {
+        sharedRegistry.Publish(0, registryVersion(v));
+    }
+
+    publishing.store(false);
+
+    for (size_t r = 0; r < readers.size(); ++r) {
+        readers[r].join();
+    }
+
+    // all readers are gone, so the next publishing reclaims every replaced version
+    sharedRegistry.Publish(0, registryVersion(NVERSIONS + 1));
+    bool drainedPassed = consistent.load() && sharedRegistry.RetiredCount() == 0;
+
+    std::ostringstream details;
+    details << NREADERS << " readers, " << NVERSIONS << " versions";
+
+    bool passed = report("model registry keeps a replaced version while a guard holds it", keptPassed);
+    passed = report("model registry deletes a replaced version after the last guard", reclaimedPassed) && passed;
+    passed = report("model registry readers during publishing", drainedPassed, details.str()) && passed;
+
+    return passed;
+}
+
+/**
+ * \brief Sink counting the received posterior blocks
+ */
+struct CountingSink : public HMM::Algorithms::PosteriorSink
+{
+    CountingSink()
+        : nblocks(0)
+    {
+    }
+
+    void ConsumePosteriors(size_t, size_t, size_t, const double*)
+    {
+        ++nblocks;
+    }
+
+    size_t nblocks;
+};
+
+/**
+ * \brief Posteriors of an empty sequence are streamed as no blocks without touching the tables,
+ * the out-of-core variant creates no scratch file
+ */
+bool checkEmptySequence()
+{
+    std::mt19937_64 engine(20261017);
+    HMM::Data::Model model;
+    HMM::Data::CompiledModel compiledModel;
+    HMM::Algorithms::Workspace workspace;
+    HMM::Data::ColumnView symbols;
+    CountingSink sink;
+    bool passed = true;
+
+    generateModel(3, engine, model);
+    compiledModel.Compile(model);
+
+    try
+    {
+        HMM::Algorithms::StreamPosteriorProbabilities(compiledModel, symbols, sink, workspace);
+
+        // the scratch directory does not exist, so creating a scratch file would fail
+        HMM::Algorithms::StreamPosteriorProbabilitiesOutOfCore(compiledModel, symbols, sink, workspace,
+                                                               "/nonexistent-hmm-scratch-directory");
+    } catch(std::exception&) {
+        passed = false;
+    }
+
+    return report("streamed posteriors of an empty sequence", passed && sink.nblocks == 0);
+}
+
+/**
+ * \brief The posterior pass returns the log-likelihood of the separate forward pass,
+ * including sequences impossible for the model
+ */
+bool checkStreamedLogLikelihood()
+{
+    const size_t NTRIALS = 200;
+
+    std::mt19937_64 engine(20261017);
+    std::uniform_int_distribution<size_t> drawStates(1, 6);
+    std::uniform_int_distribution<size_t> drawLength(1, 3000);
+    std::uniform_int_distribution<uint32_t> drawSymbol(0, CHECK_NSYMBOLS - 1);
+    HMM::Algorithms::Workspace workspace;
+    CountingSink sink;
+    bool passed = true;
+    size_t nimpossible = 0;
+
+    for (size_t trial = 0; trial < NTRIALS; ++trial) {
+        HMM::Data::Model model;
+        HMM::Data::CompiledModel compiledModel;
+        generateModel(drawStates(engine), engine, model);
+        compiledModel.Compile(model);
+
+        std::vector<uint32_t> sequence(drawLength(engine));
+
+        for (size_t t = 0; t < sequence.size(); ++t) {
+            sequence[t] = drawSymbol(engine);
+        }
+
+        HMM::Data::ColumnView symbols(sequence.data(), sequence.size(), sizeof(uint32_t), sizeof(uint32_t));
+        double exact = HMM::Algorithms::CalcLogLikelihood(compiledModel, symbols, workspace);
+        double streamed = HMM::Algorithms::StreamPosteriorProbabilities(compiledModel, symbols, sink, workspace);
+
+        nimpossible += (std::isinf(exact) ? 1 : 0);
+        passed = closeEnough(streamed, exact) && passed;
+    }
+
+    std::ostringstream details;
+    details << NTRIALS << " sequences, " << nimpossible << " impossible";
+
+    return report("log-likelihood of the posterior pass", passed, details.str());
+}
+
+int main()
+{
+    bool passed = checkModelBank("model bank", 1.);
+    passed = checkModelBank("model bank of not normalised transitions", 1.5) && passed;
+    passed = checkModelRegistry() && passed;
+    passed = checkEmptySequence() && passed;
+    passed = checkStreamedLogLikelihood() && passed;
+
+    return (passed ? 0 : -1);
+}
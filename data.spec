@@ -1,2 +1,2 @@
 <number of step triples, must be larger that zero>
-<list of one-per-line triples "step_number state symbol">
+<list of one-per-line triples "step_number state symbol"; symbol must be emitted by some state of the model>
@@ -1,37 +1,83 @@
+#include <cmath>
+#include <limits>
+#include <map>
 #include <algorithm>
+#include <numeric>
+#include <random>
+#include <functional>
 #include <vector>
 #include <stdexcept>
 #include <iostream>
+#include <string>
+#include <thread>
 #include <cstddef>
+#include <cstring>
+#include <cstdint>
 
 #include "hmm.h"
+#include "hmm_memory.h"
 
 using std::vector;
 using std::string;
 using std::pair;
 
 using HMM::Data::Model;
+using HMM::Data::CompiledModel;
 using HMM::Data::ExperimentData;
+using HMM::Data::SparseEmissionTable;
+using HMM::Data::ColumnView;
 
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> Data namespace definitions >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+/// logarithm of zero probability
+const double LOG_ZERO = -std::numeric_limits<double>::infinity();
 
-/**
- * \note
- * Auxiliary functions, for internal usage only.
- */
-namespace
+void SparseEmissionTable::Assign(size_t nstates, size_t nsymbols, const vector<Emission>& emissions)
 {
-    /**
-     * \brief Converts first string element to char emission symbol for HMM
-     *
-     * \note
-     * String assumed to be non-empty and symbol[0] is supposed to be in a..z ascii.
-     */
-    char symbolToInd(const string& symbol)
-    {
-        return symbol[0] - 'a';
+    this->nstates = nstates;
+    this->nsymbols = nsymbols;
+
+    // section: order emissions by (symbol, state), stable to keep the last of repeated pairs
+    vector<Emission> sorted(emissions);
+
+    std::stable_sort(std::begin(sorted), std::end(sorted),
+                     [](const Emission& lhs, const Emission& rhs)
+                     {return (lhs.symbol < rhs.symbol ||
+                              (lhs.symbol == rhs.symbol && lhs.state < rhs.state));});
+
+    // section: fill columns skipping zeros and overwritten pairs
+    columnStart.assign(nsymbols + 1, 0);
+    columnState.clear();
+    columnProb.clear();
+
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        bool isOverwritten = (i + 1 < sorted.size() &&
+                              sorted[i + 1].symbol == sorted[i].symbol &&
+                              sorted[i + 1].state == sorted[i].state);
+
+        if (isOverwritten || sorted[i].prob == 0) {
+            continue;
+        }
+
+        columnState.push_back(sorted[i].state);
+        columnProb.push_back(sorted[i].prob);
+        ++columnStart[sorted[i].symbol + 1];
+    }
+
+    std::partial_sum(std::begin(columnStart), std::end(columnStart), std::begin(columnStart));
+}
+
+double SparseEmissionTable::Prob(size_t state, size_t symbol) const
+{
+    const size_t* first = ColumnStates(symbol);
+    const size_t* last = first + ColumnSize(symbol);
+    const size_t* found = std::lower_bound(first, last, state);
+
+    if (found == last || *found != state) {
+        return 0.;
     }
-};
+
+    return columnProb[columnStart[symbol] + (found - first)];
+}
 
 void Model::ReadModel(std::istream& modelSource)
 {
@@ -81,9 +127,9 @@ void Model::ReadModel(std::istream& modelSource)
 
     // section: state-symbol emission probabilities reading
     size_t nemissions;
-    string symbol; // supposed to be single character, string is used for simpler reading code
+    string symbol;
+    vector<SparseEmissionTable::Emission> emissions;
 
-    stateSymbolProb.assign(nstates, vector<double> (alphabetSize, 0));
     modelSource >> nemissions;
 
     for (size_t i = 0; i < nemissions; ++i) {
@@ -91,43 +137,27 @@ void Model::ReadModel(std::istream& modelSource)
         modelSource >> stateName >> symbol >> prob;
 
         size_t stateInd = stateNameToIndex[stateName];
-        size_t symbolInd = symbolToInd(symbol);
 
         if (stateInd == 0 || stateInd + 1 == nstates) {
             throw std::domain_error("Symbol emission from the beginning or the ending states is forbidden");
         }
 
-        stateSymbolProb[stateInd][symbolInd] = prob;
-    }
-}
-
-void ExperimentData::ReadExperimentData(const Model& model, std::istream& dataSource)
-{
-    size_t nsteps;
-    size_t stepNumber;
-    string stateName;
-    string symbol;// supposed to be single character, string is used for simpler reading code
+        // dictionary encoding: new tokens get the next free index
+        if (symbolNameToIndex.find(symbol) == symbolNameToIndex.end()) {
+            if (symbolIndexToName.size() == alphabetSize) {
+                throw std::domain_error("Number of different emitted symbols exceeds the alphabet size");
+            }
 
-    dataSource >> nsteps;
+            symbolNameToIndex[symbol] = symbolIndexToName.size();
+            symbolIndexToName.push_back(symbol);
+        }
 
-    if (nsteps == 0) {
-        throw std::domain_error("Empty experiment data");
+        SparseEmissionTable::Emission emission = {stateInd, symbolNameToIndex[symbol], prob};
+        emissions.push_back(emission);
     }
 
-    for (size_t i = 0; i < nsteps; ++i) {
-        dataSource >> stepNumber >> stateName >> symbol;
-
-        size_t stateInd = model.stateNameToIndex.at(stateName);
-        size_t symbolInd = symbolToInd(symbol);
-
-        timeStateSymbol.emplace_back(stepNumber, stateInd, symbolInd);
-    }
+    stateSymbolProb.Assign(nstates, alphabetSize, emissions);
 }
-//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< end of Data namespace definitions <<<<<<<<<<<<<<<<<<<<<<<<<<
-
-
-//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> Algorithms namespace definitions >>>>>>>>>>>>>>>>>>>>>>>>>>
-const size_t HMM_UNDEFINED_STATE = -1;
 
 /**
  * \note
@@ -135,324 +165,2266 @@ const size_t HMM_UNDEFINED_STATE = -1;
  */
 namespace
 {
-    /**
-     * \brief Aux. function to calculate new state probability for the Viterbi algorithm step
-     */
-    double CalcNewStateProbability(size_t stepNumber, size_t prevState,
-                                   size_t curState, size_t curSymbol, const Model& model,
-                                   const vector<vector<double> >& sequenceProbability)
-    {
-        double prevProbability = 1.;
-
-        if (stepNumber == 0 && prevState == 0) {
-            prevProbability = 1.;
-        } else if (stepNumber == 0 && prevState != 0) {
-            prevProbability = 0.;
-        } else {
-            prevProbability = sequenceProbability[stepNumber - 1][prevState];
-        }
+    using HMM::Data::PruneReason;
 
-        return (prevProbability *
-                model.transitionProb[prevState][curState] *
-                model.stateSymbolProb[curState][curSymbol]);
+    double SafeLog(double prob)
+    {
+        return (prob > 0 ? std::log(prob) : LOG_ZERO);
     }
 
     /**
-     * \brief Aux. function to find the best previous state during the Viterbi algorithm step
+     * \brief Aux. function to mark states reachable over the transitions from the start states
+     *
+     * \details
+     * Traversal goes through the states for which canPass is true only.
+     * If isReversed is true transitions are followed in the opposite direction.
      */
-    size_t FindBestTransitionSource(size_t stepNumber, size_t curState,
-                                    size_t curSymbol, const Model& model,
-                                    const vector<vector<double> >& sequenceProbability)
+    vector<bool> FindReachableStates(const Model& model, const vector<size_t>& startStates,
+                                     const vector<bool>& canPass, bool isReversed)
     {
-        if (stepNumber == 0) {
-            return 0;
-        }
-
         size_t nstates = model.transitionProb.size();
-        double bestProbValue = -1;
-        size_t bestPrevState = HMM_UNDEFINED_STATE;
+        vector<bool> isReached(nstates, false);
+        vector<size_t> pending(startStates);
+
+        for (size_t i = 0; i < startStates.size(); ++i) {
+            isReached[startStates[i]] = true;
+        }
 
-        for (size_t prevState = 0; prevState < nstates; ++prevState) {
-            double curProb = CalcNewStateProbability(stepNumber, prevState,
-                                                     curState, curSymbol,
-                                                     model, sequenceProbability);
+        while (! pending.empty()) {
+            size_t curState = pending.back();
+            pending.pop_back();
 
-            if (curProb > bestProbValue) {
-                bestProbValue = curProb;
-                bestPrevState = prevState;
+            for (size_t nextState = 0; nextState < nstates; ++nextState) {
+                double prob = (isReversed ?
+                               model.transitionProb[nextState][curState] :
+                               model.transitionProb[curState][nextState]);
+
+                if (prob != 0 && canPass[nextState] && ! isReached[nextState]) {
+                    isReached[nextState] = true;
+                    pending.push_back(nextState);
+                }
             }
         }
 
-        // there must be at least two states => the result won't be undefined
-        return bestPrevState;
+        return isReached;
     }
 
     /**
-     * \brief Aux. function to get the cumulative forward step transition probability
+     * \brief Aux. function to find states which may be occupied at an observation step
      *
      * \details
-     * This is used inside forward-backward algorithm at forward probabilities calculation.
+     * Live state emits some symbol, is reachable from the begin state and can reach
+     * the end state, both through emitting states. If no emitting state has a transition
+     * into the end state the model is treated as open-ended and the last condition is skipped.
      */
-    double CalcForwardStepProbability(size_t stepNumber, size_t curState,
-                                      const Model& model, const ExperimentData& data,
-                                      const vector<vector<double> >& forwardStateProbability)
+    void FindLiveStates(const Model& model, vector<PruneReason>& stateStatus, bool& isOpenEnded)
     {
         size_t nstates = model.transitionProb.size();
-        size_t curSymbol = std::get<2> (data.timeStateSymbol[stepNumber]);
+        const SparseEmissionTable& emissionTable = model.stateSymbolProb;
+        vector<bool> isEmitting(nstates, false);
 
-        if (stepNumber == 0) {
-            return model.transitionProb[0][curState] * model.stateSymbolProb[curState][curSymbol];
-        } else {
-            double prevCumulativeProb = 0;
+        for (size_t k = 0; k < emissionTable.columnState.size(); ++k) {
+            isEmitting[emissionTable.columnState[k]] = true;
+        }
 
-            for (size_t prevState = 0; prevState < nstates; ++prevState) {
-                prevCumulativeProb += (forwardStateProbability[stepNumber - 1][prevState] *
-                                       model.transitionProb[prevState][curState]);
+        vector<bool> isReachable = FindReachableStates(model, vector<size_t> (1, 0), isEmitting, false);
+        vector<bool> canReachEnd = FindReachableStates(model, vector<size_t> (1, nstates - 1), isEmitting, true);
+
+        isOpenEnded = true;
+
+        for (size_t i = 0; i < nstates; ++i) {
+            if (isEmitting[i] && model.transitionProb[i][nstates - 1] != 0) {
+                isOpenEnded = false;
             }
+        }
 
-            return prevCumulativeProb * model.stateSymbolProb[curState][curSymbol];
+        stateStatus.assign(nstates, PruneReason::None);
+
+        for (size_t i = 0; i < nstates; ++i) {
+            if (! isEmitting[i]) {
+                stateStatus[i] = PruneReason::NoEmissions;
+            } else if (! isReachable[i]) {
+                stateStatus[i] = PruneReason::UnreachableFromBegin;
+            } else if (! isOpenEnded && ! canReachEnd[i]) {
+                stateStatus[i] = PruneReason::CannotReachEnd;
+            }
         }
     }
+};
 
-    /**
-     * \brief Aux. function to get the cumulative probability for the backward step
-     *
-     * \details
-     * This is used inside forward-backward algorithm at backward probabilities calculation.
-     */
-    double CalcBackwardStepProbability(size_t stepNumber, size_t curState,
-                                       const Model& model, const ExperimentData& data,
-                                       const vector<vector<double> >& backwardStateProbability)
-    {
-        size_t nstates = model.transitionProb.size();
-        size_t maxtime = data.timeStateSymbol.size();
+void CompiledModel::Compile(const Model& model)
+{
+    const SparseEmissionTable& modelEmission = model.stateSymbolProb;
 
-        if (stepNumber + 1 == maxtime) {
-            return 1.; // probability to describe empty sequence is 1.
+    nmodelStates = model.transitionProb.size();
+    nmodelSymbols = model.alphabetSize;
+
+    // section: find live states, the rest is pruned with the reason recorded
+    FindLiveStates(model, stateStatus, isOpenEnded);
+
+    compiledToOriginal.clear();
+    eliminatedStates.clear();
+    originalToCompiled.assign(nmodelStates, UNDEFINED_STATE);
+
+    for (size_t i = 0; i < nmodelStates; ++i) {
+        if (stateStatus[i] == PruneReason::None) {
+            originalToCompiled[i] = compiledToOriginal.size();
+            compiledToOriginal.push_back(i);
         } else {
-            size_t nextSymbol = std::get<2> (data.timeStateSymbol[stepNumber + 1]);
-            double nextCumulativeProb = 0.;
+            eliminatedStates.push_back(i);
+        }
+    }
 
-            for (size_t nextState = 0; nextState < nstates; ++nextState) {
-                nextCumulativeProb += (model.transitionProb[curState][nextState] *
-                                       model.stateSymbolProb[nextState][nextSymbol] *
-                                       backwardStateProbability[stepNumber + 1][nextState]);
-            }
+    nstates = compiledToOriginal.size();
 
-            return nextCumulativeProb;
+    // section: dense transition tables over live states
+    initialProb.assign(nstates, 0.);
+    logInitialProb.assign(nstates, LOG_ZERO);
+    transitionProb.assign(nstates * nstates, 0.);
+    transitionProbTransposed.assign(nstates * nstates, 0.);
+    logTransitionProbTransposed.assign(nstates * nstates, LOG_ZERO);
+
+    size_t ntransitions = 0;
+
+    for (size_t j = 0; j < nstates; ++j) {
+        initialProb[j] = model.transitionProb[0][compiledToOriginal[j]];
+        logInitialProb[j] = SafeLog(initialProb[j]);
+    }
+
+    for (size_t i = 0; i < nstates; ++i) {
+        for (size_t j = 0; j < nstates; ++j) {
+            double prob = model.transitionProb[compiledToOriginal[i]][compiledToOriginal[j]];
+
+            transitionProb[i * nstates + j] = prob;
+            transitionProbTransposed[j * nstates + i] = prob;
+            logTransitionProbTransposed[j * nstates + i] = SafeLog(prob);
+            ntransitions += (prob != 0 ? 1 : 0);
         }
     }
-};
 
-vector<size_t>
-HMM::Algorithms::FindMostProbableStateSequence(const Model& model, const ExperimentData& data)
-{
-    // section: prepare and initialize data structures for calculations
-    size_t nstates = model.transitionProb.size();
-    size_t maxtime = data.timeStateSymbol.size();
+    preferSparse = (ntransitions < SPARSE_TRANSITIONS_DENSITY * nstates * nstates);
 
-    /**
-     * \note
-     * sequenceProbability[i][j] is the probability of the most probable sequence of states
-     * for 1..i observations for which the last state is j-th
-     */
-    vector<vector<double> > sequenceProbability(maxtime,
-                                                vector<double> (nstates, 0));
+    // section: sparse predecessor lists
+    predecessorStart.assign(1, 0);
+    predecessorState.clear();
+    predecessorProb.clear();
+    logPredecessorProb.clear();
 
-    /**
-     * \note
-     * prevSeqState[i][j] is the previous state from which the most probable
-     * sequence (with probability sequenceProbability[i][j]) for 1..i observations with the last
-     * state at j has been formed.
-     * This information will help to recover the whole sequence.
-     */
-    vector<vector<size_t> > prevSeqState(maxtime,
-                                         vector<size_t> (nstates, HMM_UNDEFINED_STATE));
+    for (size_t j = 0; j < nstates; ++j) {
+        for (size_t i = 0; i < nstates; ++i) {
+            double prob = transitionProbTransposed[j * nstates + i];
 
-    // section: calculate probabilities for Viterbi algorithm using dynamic programming approach
-    for (size_t t = 0; t < maxtime; ++t) {
-        for (size_t curState = 0; curState < nstates; ++curState) {
-            size_t curSymbol = std::get<2> (data.timeStateSymbol[t]);
-            size_t bestPrevState = FindBestTransitionSource(t, curState,
-                                                            curSymbol, model,
-                                                            sequenceProbability);
-            double bestProbValue = CalcNewStateProbability(t, bestPrevState,
-                                                           curState, curSymbol,
-                                                           model, sequenceProbability);
+            if (prob != 0) {
+                predecessorState.push_back(i);
+                predecessorProb.push_back(prob);
+                logPredecessorProb.push_back(std::log(prob));
+            }
+        }
+
+        predecessorStart.push_back(predecessorState.size());
+    }
+
+    // section: emissions of live states over the symbols emitted by them
+    vector<SparseEmissionTable::Emission> emissions;
+
+    compiledToOriginalSymbol.clear();
+    symbolToCompiled.assign(nmodelSymbols, UNDEFINED_STATE);
+
+    for (size_t symbol = 0; symbol < modelEmission.nsymbols; ++symbol) {
+        for (size_t k = modelEmission.columnStart[symbol]; k < modelEmission.columnStart[symbol + 1]; ++k) {
+            size_t curState = originalToCompiled[modelEmission.columnState[k]];
+
+            if (curState == UNDEFINED_STATE) {
+                continue;
+            }
+
+            if (symbolToCompiled[symbol] == UNDEFINED_STATE) {
+                symbolToCompiled[symbol] = compiledToOriginalSymbol.size();
+                compiledToOriginalSymbol.push_back(symbol);
+            }
 
-            sequenceProbability[t][curState] = bestProbValue;
-            prevSeqState[t][curState] = bestPrevState;
+            SparseEmissionTable::Emission emission =
+                {curState, symbolToCompiled[symbol], modelEmission.columnProb[k]};
+            emissions.push_back(emission);
         }
     }
 
-    // section: collect most probable sequence in the reverse order
-    vector<size_t> mostProbableSeq;
-    ptrdiff_t curStep = maxtime - 1;
+    // dead symbols share the trailing empty column
+    nsymbols = compiledToOriginalSymbol.size();
+    std::replace(std::begin(symbolToCompiled), std::end(symbolToCompiled), UNDEFINED_STATE, nsymbols);
+
+    stateSymbolProb.Assign(nstates, nsymbols + 1, emissions);
+    logColumnProb.resize(stateSymbolProb.columnProb.size());
+    std::transform(std::begin(stateSymbolProb.columnProb), std::end(stateSymbolProb.columnProb),
+                   std::begin(logColumnProb), SafeLog);
+
+    // section: per-symbol transfer matrices over emitting states, if they fit into the limit
+    size_t nemissions = stateSymbolProb.columnState.size();
 
-    // find the last state of the most probable sequence to start recovery from it
-    size_t curState = std::distance(std::begin(sequenceProbability[curStep]),
-                                    std::max_element(std::begin(sequenceProbability[curStep]),
-                                                     std::end(sequenceProbability[curStep])));
+    transferProb.clear();
+    logTransferProb.clear();
 
-    for (; curStep > 0; --curStep) {
-        curState = prevSeqState[curStep][curState];
-        mostProbableSeq.push_back(curState);
+    if (nemissions * nstates * sizeof(double) <= MAX_TRANSFER_BYTES) {
+        transferProb.resize(nemissions * nstates);
+        logTransferProb.resize(nemissions * nstates);
+
+        for (size_t k = 0; k < nemissions; ++k) {
+            size_t curState = stateSymbolProb.columnState[k];
+
+            for (size_t prevState = 0; prevState < nstates; ++prevState) {
+                transferProb[k * nstates + prevState] =
+                    transitionProbTransposed[curState * nstates + prevState] * stateSymbolProb.columnProb[k];
+                logTransferProb[k * nstates + prevState] =
+                    logTransitionProbTransposed[curState * nstates + prevState] + logColumnProb[k];
+            }
+        }
     }
 
-    mostProbableSeq.push_back(curState);
+    // section: transitions of eliminated states into live states
+    eliminatedStart.assign(1, 0);
+    eliminatedSuccessor.clear();
+    eliminatedProb.clear();
+
+    for (size_t d = 0; d < eliminatedStates.size(); ++d) {
+        for (size_t j = 0; j < nstates; ++j) {
+            double prob = model.transitionProb[eliminatedStates[d]][compiledToOriginal[j]];
 
-    // section: restore correct order and return results
-    std::reverse(std::begin(mostProbableSeq), std::end(mostProbableSeq));
+            if (prob != 0) {
+                eliminatedSuccessor.push_back(j);
+                eliminatedProb.push_back(prob);
+            }
+        }
 
-    return std::move(mostProbableSeq);
+        eliminatedStart.push_back(eliminatedSuccessor.size());
+    }
 }
 
-vector<vector<pair<double, double> > >
-HMM::Algorithms::CalcForwardBackwardProbabiliies(const Model& model, const ExperimentData& data)
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ */
+namespace
 {
-    size_t nstates = model.transitionProb.size();
-    size_t maxtime = data.timeStateSymbol.size();
+    typedef vector<pair<size_t, double> > EmissionRow;
 
     /**
-     * \note
-     * forwardStateProbability[i][j] is the probability that any hidden sequence (with
-     * the hidden state at i-th step equal to j) describes first 1..i observations.
+     * \brief Aux. function to check that all transition sums into blocks agree within the tolerance
      */
-    vector<vector<double> > forwardStateProbability(maxtime, vector<double> (nstates, 0));
-
-    // section: calculate forward probabilities of the forward-backward algorithm
-    for (size_t t = 0; t < maxtime; ++t) {
-        for (size_t curState = 0; curState < nstates; ++curState) {
-            double cumulativePrevProbability =
-                CalcForwardStepProbability(t, curState, model, data, forwardStateProbability);
-
-            forwardStateProbability[t][curState] = cumulativePrevProbability;
+    bool HaveEqualBlockSums(const double* first, const double* second, size_t nblocks)
+    {
+        for (size_t b = 0; b < nblocks; ++b) {
+            if (std::fabs(first[b] - second[b]) > HMM::Data::LUMPING_TOLERANCE) {
+                return false;
+            }
         }
+
+        return true;
     }
 
     /**
-     * \note
-     * backwardStateProbability[i][j] is the probability that any hidden sequence (with
-     * the hidden state at i+1 step equal to j) describes last i+1..T observations.
+     * \brief Aux. function to split blocks by transition probability sums into the blocks
+     *
+     * \returns new number of blocks, equal to the old one if the partition is stable
      */
-    vector<vector<double> > backwardStateProbability(maxtime, vector<double> (nstates, 0.));
+    size_t RefineBlocks(const Model& model, vector<size_t>& blockOf, size_t nblocks)
+    {
+        size_t nstates = blockOf.size();
+        vector<double> blockSums(nstates * nblocks, 0.);
 
-    // section: calculate backward probabilities of the forward-backward algorithm
-    for (ptrdiff_t t = maxtime - 1; t >= 0; --t) {
-        for (size_t curState = 0; curState < nstates; ++curState) {
-            double cumulativeNextProbability =
-                CalcBackwardStepProbability(t, curState, model, data, backwardStateProbability);
+        for (size_t i = 0; i < nstates; ++i) {
+            for (size_t j = 0; j < nstates; ++j) {
+                blockSums[i * nblocks + blockOf[j]] += model.transitionProb[i][j];
+            }
+        }
+
+        // states of the old block keep together while their sums match the first state of a new block
+        vector<vector<size_t> > blockLeaders(nblocks);
+        vector<size_t> newBlockOf(nstates);
+        size_t nnewBlocks = 0;
+
+        for (size_t i = 0; i < nstates; ++i) {
+            vector<size_t>& leaders = blockLeaders[blockOf[i]];
+            size_t l = 0;
+
+            while (l < leaders.size() &&
+                   ! HaveEqualBlockSums(&blockSums[i * nblocks], &blockSums[leaders[l] * nblocks], nblocks)) {
+                ++l;
+            }
 
-            backwardStateProbability[t][curState] = cumulativeNextProbability;
+            if (l == leaders.size()) {
+                leaders.push_back(i);
+                newBlockOf[i] = nnewBlocks++;
+            } else {
+                newBlockOf[i] = newBlockOf[leaders[l]];
+            }
         }
+
+        blockOf.swap(newBlockOf);
+
+        return nnewBlocks;
     }
+};
 
-    // section: return joined results
-    vector<vector<pair<double, double> > > forwardBackwardProbability
-        (maxtime, vector<pair<double, double> > (nstates, pair<double, double>()));
+void HMM::Data::LumpedModel::Minimise(const Model& source)
+{
+    size_t nstates = source.transitionProb.size();
+    const SparseEmissionTable& sourceEmission = source.stateSymbolProb;
 
-    for (size_t t = 0; t < maxtime; ++t) {
-        for (size_t curState = 0; curState < nstates; ++curState) {
-            forwardBackwardProbability[t][curState] =
-                pair<double, double>(forwardStateProbability[t][curState],
-                                     backwardStateProbability[t][curState]);
+    // section: initial partition by emission distributions, begin and end states stay single
+    vector<EmissionRow> emissionRows(nstates);
+
+    for (size_t symbol = 0; symbol < sourceEmission.nsymbols; ++symbol) {
+        for (size_t k = sourceEmission.columnStart[symbol]; k < sourceEmission.columnStart[symbol + 1]; ++k) {
+            emissionRows[sourceEmission.columnState[k]].push_back(
+                std::make_pair(symbol, sourceEmission.columnProb[k]));
         }
     }
 
-    return std::move(forwardBackwardProbability);
-}
-//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< end of Algorithms namespace definitions <<<<<<<<<<<<<<<<<<<<
+    std::map<EmissionRow, size_t> emissionBlocks;
+    vector<size_t> blockOf(nstates);
+    size_t nblocks = 0;
 
+    for (size_t i = 0; i < nstates; ++i) {
+        if (i == 0 || i + 1 == nstates) {
+            blockOf[i] = nblocks++;
+            continue;
+        }
 
-//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> Estimation namespace definitions >>>>>>>>>>>>>>>>>>>>>>>>>>>
-vector<size_t> HMM::Estimation::GetMostProbableStates(
-    const vector<vector<pair<double, double> > >& forwardBackwardProb)
-{
-    size_t maxtime = forwardBackwardProb.size();
-    vector<size_t> mostProbableStates;
+        std::map<EmissionRow, size_t>::iterator found = emissionBlocks.find(emissionRows[i]);
 
-    for (size_t t = 0; t < maxtime; ++t) {
-        size_t mostProbableState =
-            std::distance(std::begin(forwardBackwardProb[t]),
-                          std::max_element(std::begin(forwardBackwardProb[t]),
-                                           std::end(forwardBackwardProb[t]),
-                                           [](const pair<double, double>& prev,
-                                              const pair<double, double>& next)
-                                           {return (prev.first * prev.second <
-                                                    next.first * next.second);}));
-        mostProbableStates.push_back(mostProbableState);
+        if (found == emissionBlocks.end()) {
+            emissionBlocks[emissionRows[i]] = nblocks;
+            blockOf[i] = nblocks++;
+        } else {
+            blockOf[i] = found->second;
+        }
+    }
+
+    // section: refine until every block has equal transition sums into each block
+    for (size_t nrefined = RefineBlocks(source, blockOf, nblocks); nrefined != nblocks;
+         nrefined = RefineBlocks(source, blockOf, nblocks)) {
+        nblocks = nrefined;
+    }
+
+    // refinement numbers blocks by their first states, so begin is first and end is last
+    originalToLumped = blockOf;
+    lumpedToOriginal.assign(nblocks, vector<size_t> ());
+
+    for (size_t i = 0; i < nstates; ++i) {
+        lumpedToOriginal[blockOf[i]].push_back(i);
+    }
+
+    // section: lumped model built from the first state of each block
+    model = Model();
+    model.alphabetSize = source.alphabetSize;
+    model.symbolNameToIndex = source.symbolNameToIndex;
+    model.symbolIndexToName = source.symbolIndexToName;
+    model.transitionProb.assign(nblocks, vector<double> (nblocks, 0.));
+
+    vector<SparseEmissionTable::Emission> emissions;
+
+    for (size_t b = 0; b < nblocks; ++b) {
+        const vector<size_t>& members = lumpedToOriginal[b];
+        string name = source.stateIndexToName[members[0]];
+
+        for (size_t m = 1; m < members.size(); ++m) {
+            name += '+' + source.stateIndexToName[members[m]];
+        }
+
+        model.stateNameToIndex[name] = b;
+        model.stateIndexToName.push_back(name);
+
+        for (size_t j = 0; j < nstates; ++j) {
+            model.transitionProb[b][blockOf[j]] += source.transitionProb[members[0]][j];
+        }
+
+        const EmissionRow& emissionRow = emissionRows[members[0]];
+
+        for (size_t k = 0; k < emissionRow.size(); ++k) {
+            SparseEmissionTable::Emission emission = {b, emissionRow[k].first, emissionRow[k].second};
+            emissions.push_back(emission);
+        }
     }
 
-    return std::move(mostProbableStates);
+    model.stateSymbolProb.Assign(nblocks, sourceEmission.nsymbols, emissions);
 }
 
-vector<vector<size_t> >
-HMM::Estimation::CombineConfusionMatrix(const ExperimentData& realData,
-                                        const vector<size_t>& predictedStates,
-                                        const Model& model)
+vector<size_t> HMM::Data::LumpedModel::ExpandStateSequence(const Model& source, const ColumnView& symbols,
+                                                           const vector<size_t>& lumpedStates) const
 {
-    size_t maxtime = predictedStates.size();
-    size_t nstates = model.transitionProb.size();
-    vector<vector<size_t> > confusionMatrix(nstates, vector<size_t> (nstates, 0));
+    size_t maxtime = std::min(symbols.size(), lumpedStates.size());
+
+    if (maxtime == 0) {
+        return vector<size_t> ();
+    }
+
+    // section: viterbi over the members of the given lumped states, backpointers per step
+    vector<size_t> stepStart(1, 0);
 
     for (size_t t = 0; t < maxtime; ++t) {
-        size_t predictedInd = predictedStates[t];
-        size_t realInd      = std::get<1>(realData.timeStateSymbol[t]);
+        stepStart.push_back(stepStart.back() + lumpedToOriginal[lumpedStates[t]].size());
+    }
+
+    vector<double> logProb(stepStart.back(), LOG_ZERO);
+    vector<size_t> prevMember(stepStart.back(), UNDEFINED_STATE);
+
+    for (size_t t = 0; t < maxtime; ++t) {
+        const vector<size_t>& curMembers = lumpedToOriginal[lumpedStates[t]];
+
+        for (size_t m = 0; m < curMembers.size(); ++m) {
+            size_t curState = curMembers[m];
+            double logEmission = SafeLog(source.stateSymbolProb.Prob(curState, symbols[t]));
+            double& curLogProb = logProb[stepStart[t] + m];
+
+            if (t == 0) {
+                curLogProb = SafeLog(source.transitionProb[0][curState]) + logEmission;
+                continue;
+            }
+
+            const vector<size_t>& prevMembers = lumpedToOriginal[lumpedStates[t - 1]];
+
+            for (size_t p = 0; p < prevMembers.size(); ++p) {
+                double prob = logProb[stepStart[t - 1] + p] +
+                              SafeLog(source.transitionProb[prevMembers[p]][curState]) + logEmission;
+
+                if (prob > curLogProb) {
+                    curLogProb = prob;
+                    prevMember[stepStart[t] + m] = p;
+                }
+            }
+        }
+    }
+
+    // section: traceback from the most probable last member
+    vector<size_t> states(maxtime, 0);
+    size_t curMember = std::distance(logProb.begin() + stepStart[maxtime - 1],
+                                     std::max_element(logProb.begin() + stepStart[maxtime - 1], logProb.end()));
+
+    if (logProb[stepStart[maxtime - 1] + curMember] == LOG_ZERO) {
+        // no source state sequence can emit the observations
+        return states;
+    }
 
-        ++confusionMatrix[predictedInd][realInd];
+    for (size_t t = maxtime; t-- > 0; ) {
+        states[t] = lumpedToOriginal[lumpedStates[t]][curMember];
+        curMember = prevMember[stepStart[t] + curMember];
     }
 
-    return std::move(confusionMatrix);
+    return states;
 }
 
-vector<HMM::Data::PredictionEstimation>
-HMM::Estimation::GetStatePredictionEstimations(const vector<vector<size_t> >& confusionMatrix)
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ */
+namespace
 {
-    size_t nstates = confusionMatrix.size();
-    vector<PredictionEstimation> estimations(nstates);
-    vector<size_t> colSums(nstates, 0);
-    vector<size_t> rowSums(nstates, 0);
-
-    // section: prepare auxiliary columns sums and row sums for further usage
-    for (size_t i = 0; i < nstates; ++i) {
-        for (size_t j = 0; j < nstates; ++j) {
-            rowSums[i] += confusionMatrix[i][j];
-            colSums[i] += confusionMatrix[j][i];
+    /**
+     * \brief Aux. function to find the narrowest element width (in bytes) fitting the value
+     */
+    size_t NarrowestWidth(size_t maxValue)
+    {
+        if (maxValue <= 0xFFUL) {
+            return 1;
+        } else if (maxValue <= 0xFFFFUL) {
+            return 2;
+        } else if (maxValue <= 0xFFFFFFFFUL) {
+            return 4;
         }
+
+        return 8;
     }
 
-    size_t totalObservations = std::accumulate(std::begin(rowSums),
-                                               std::end(rowSums), 0UL);
+    /**
+     * \brief Aux. function to read experiment data triples passing them to the consumer
+     *
+     * \details
+     * consume(stepNumber, stateInd, symbolInd) is called for each triple,
+     * reserve(nsteps) is called before the first triple.
+     */
+    template <typename Reserve, typename Consume>
+    void ReadDataTriples(const Model& model, std::istream& dataSource, Reserve reserve, Consume consume)
+    {
+        size_t nsteps;
+        size_t stepNumber;
+        string stateName;
+        string symbol;
+
+        dataSource >> nsteps;
 
-    // section: calculate prediction estimations for each state
-    for (size_t state = 0; state < nstates; ++state) {
-        estimations[state].truePositives = confusionMatrix[state][state];
-        estimations[state].falsePositives = rowSums[state] - confusionMatrix[state][state];
+        if (nsteps == 0) {
+            throw std::domain_error("Empty experiment data");
+        }
 
-        // neither predicted to be current state nor its real state is the current one
-        estimations[state].trueNegatives = totalObservations - rowSums[state] - colSums[state] + confusionMatrix[state][state]; 
-        estimations[state].falseNegatives = colSums[state] - confusionMatrix[state][state];
+        reserve(nsteps);
 
-        // calculate f-measure
-        double precision = 0;
-        double recall = 0;
+        for (size_t i = 0; i < nsteps; ++i) {
+            dataSource >> stepNumber >> stateName >> symbol;
 
-        if (rowSums[state] != 0) {
-            precision = static_cast<double> (confusionMatrix[state][state]) / static_cast<double> (rowSums[state]);
-        }
+            size_t stateInd = model.stateNameToIndex.at(stateName);
+            std::unordered_map<string, size_t>::const_iterator symbolIt = model.symbolNameToIndex.find(symbol);
+
+            if (symbolIt == model.symbolNameToIndex.end()) {
+                throw std::domain_error("Symbol '" + symbol + "' is not emitted by any model state");
+            }
 
-        if (colSums[state] != 0) {
-            recall = static_cast<double> (confusionMatrix[state][state]) / static_cast<double> (colSums[state]);
+            consume(stepNumber, stateInd, symbolIt->second);
         }
+    }
+};
 
-        if (rowSums[state] == 0 && colSums[state] == 0) {
-            estimations[state].fMeasure = 0;
-        } else {
-            estimations[state].fMeasure = 2. * (precision * recall) / (precision + recall);
+void HMM::Data::PackedColumn::Reset(size_t maxValue)
+{
+    width = NarrowestWidth(maxValue);
+    bytes.clear();
+}
+
+void HMM::Data::PackedColumn::PushBack(size_t value)
+{
+    // section: repack existing elements if the value does not fit current width
+    size_t valueWidth = NarrowestWidth(value);
+
+    if (valueWidth > width) {
+        ColumnView oldView = View();
+        PackedColumn widened;
+
+        widened.width = valueWidth;
+        widened.bytes.reserve(bytes.capacity() / width * valueWidth);
+
+        for (size_t i = 0; i < oldView.size(); ++i) {
+            widened.PushBack(oldView[i]);
+        }
+
+        *this = std::move(widened);
+    }
+
+    // section: append value bytes in the host byte order
+    uint8_t  value8  = static_cast<uint8_t>  (value);
+    uint16_t value16 = static_cast<uint16_t> (value);
+    uint32_t value32 = static_cast<uint32_t> (value);
+    uint64_t value64 = static_cast<uint64_t> (value);
+    const unsigned char* valueBytes =
+        (width == 1 ? &value8 :
+         width == 2 ? reinterpret_cast<const unsigned char*> (&value16) :
+         width == 4 ? reinterpret_cast<const unsigned char*> (&value32) :
+                      reinterpret_cast<const unsigned char*> (&value64));
+
+    bytes.insert(bytes.end(), valueBytes, valueBytes + width);
+}
+
+void ExperimentData::ReadExperimentData(const Model& model, std::istream& dataSource)
+{
+    ReadDataTriples(model, dataSource,
+                    [this](size_t nsteps) { timeStateSymbol.reserve(nsteps); },
+                    [this](size_t stepNumber, size_t stateInd, size_t symbolInd)
+                    { timeStateSymbol.emplace_back(stepNumber, stateInd, symbolInd); });
+}
+
+HMM::Data::ColumnView ExperimentData::SymbolColumn() const
+{
+    if (timeStateSymbol.empty()) {
+        return ColumnView();
+    }
+
+    return ColumnView(&std::get<2> (timeStateSymbol[0]), timeStateSymbol.size(),
+                      sizeof(timeStateSymbol[0]), sizeof(size_t));
+}
+
+HMM::Data::ColumnView ExperimentData::StateColumn() const
+{
+    if (timeStateSymbol.empty()) {
+        return ColumnView();
+    }
+
+    return ColumnView(&std::get<1> (timeStateSymbol[0]), timeStateSymbol.size(),
+                      sizeof(timeStateSymbol[0]), sizeof(size_t));
+}
+
+void HMM::Data::ColumnarExperimentData::ReadExperimentData(const Model& model, std::istream& dataSource)
+{
+    times.Reset(0);
+    states.Reset(model.stateIndexToName.size() - 1);
+    symbols.Reset(model.alphabetSize == 0 ? 0 : model.alphabetSize - 1);
+
+    ReadDataTriples(model, dataSource,
+                    [this](size_t nsteps)
+                    {
+                        times.bytes.reserve(nsteps * times.width);
+                        states.bytes.reserve(nsteps * states.width);
+                        symbols.bytes.reserve(nsteps * symbols.width);
+                    },
+                    [this](size_t stepNumber, size_t stateInd, size_t symbolInd)
+                    {
+                        times.PushBack(stepNumber);
+                        states.PushBack(stateInd);
+                        symbols.PushBack(symbolInd);
+                    });
+}
+//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< end of Data namespace definitions <<<<<<<<<<<<<<<<<<<<<<<<<<
+
+
+//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> Algorithms namespace definitions >>>>>>>>>>>>>>>>>>>>>>>>>>
+using HMM::Data::UNDEFINED_STATE;
+using HMM::Algorithms::Workspace;
+
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ * Recurrences work with compiled (live) state indices, they visit only states
+ * emitting the observed symbol, other states have zero probability at that step.
+ */
+namespace
+{
+    double DotProduct(const double* lhs, const double* rhs, size_t size)
+    {
+        double result = 0.;
+
+        for (size_t i = 0; i < size; ++i) {
+            result += lhs[i] * rhs[i];
+        }
+
+        return result;
+    }
+
+    /**
+     * \brief Aux. function to add scaled source row to the target row
+     */
+    void AddScaledRow(double scale, const double* source, double* target, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            target[i] += scale * source[i];
+        }
+    }
+
+    /**
+     * \brief Aux. function to scale the row to the unit sum
+     *
+     * \returns sum of the row before scaling, zero rows are left as is
+     */
+    double NormaliseRow(double* row, size_t size)
+    {
+        double sum = std::accumulate(row, row + size, 0.);
+
+        if (sum == 0) {
+            return sum;
+        }
+
+        for (size_t i = 0; i < size; ++i) {
+            row[i] /= sum;
+        }
+
+        return sum;
+    }
+
+    /**
+     * \brief Aux. function to calculate forward probabilities of the step from the previous ones
+     *
+     * \note
+     * prevForward is not used for the very first step.
+     */
+    void CalcForwardRow(const CompiledModel& model, bool useSparse, size_t stepNumber, size_t symbol,
+                        const double* prevForward, double* curForward)
+    {
+        const SparseEmissionTable& emissionTable = model.stateSymbolProb;
+        size_t nstates = model.nstates;
+
+        std::fill(curForward, curForward + nstates, 0.);
+
+        for (size_t k = emissionTable.columnStart[symbol]; k < emissionTable.columnStart[symbol + 1]; ++k) {
+            size_t curState = emissionTable.columnState[k];
+            double emissionProb = emissionTable.columnProb[k];
+            double prevCumulativeProb = 0.;
+
+            if (stepNumber == 0) {
+                prevCumulativeProb = model.initialProb[curState] * emissionProb;
+            } else if (useSparse) {
+                for (size_t p = model.predecessorStart[curState]; p < model.predecessorStart[curState + 1]; ++p) {
+                    prevCumulativeProb += prevForward[model.predecessorState[p]] * model.predecessorProb[p];
+                }
+
+                prevCumulativeProb *= emissionProb;
+            } else if (! model.transferProb.empty()) {
+                prevCumulativeProb = DotProduct(prevForward, &model.transferProb[k * nstates], nstates);
+            } else {
+                prevCumulativeProb = emissionProb *
+                    DotProduct(prevForward, &model.transitionProbTransposed[curState * nstates], nstates);
+            }
+
+            curForward[curState] = prevCumulativeProb;
+        }
+    }
+
+    /**
+     * \brief Aux. function to calculate backward probabilities of the step from the next ones
+     */
+    void CalcBackwardRow(const CompiledModel& model, bool useSparse, size_t nextSymbol,
+                         const double* nextBackward, double* curBackward)
+    {
+        const SparseEmissionTable& emissionTable = model.stateSymbolProb;
+        size_t nstates = model.nstates;
+
+        std::fill(curBackward, curBackward + nstates, 0.);
+
+        for (size_t k = emissionTable.columnStart[nextSymbol]; k < emissionTable.columnStart[nextSymbol + 1]; ++k) {
+            size_t nextState = emissionTable.columnState[k];
+            double emissionProb = emissionTable.columnProb[k];
+
+            if (useSparse) {
+                double nextProb = emissionProb * nextBackward[nextState];
+
+                for (size_t p = model.predecessorStart[nextState]; p < model.predecessorStart[nextState + 1]; ++p) {
+                    curBackward[model.predecessorState[p]] += model.predecessorProb[p] * nextProb;
+                }
+            } else if (! model.transferProb.empty()) {
+                AddScaledRow(nextBackward[nextState], &model.transferProb[k * nstates], curBackward, nstates);
+            } else {
+                AddScaledRow(emissionProb * nextBackward[nextState],
+                             &model.transitionProbTransposed[nextState * nstates], curBackward, nstates);
+            }
+        }
+    }
+
+    /**
+     * \brief Aux. function to calculate the Viterbi step in the log space
+     *
+     * \details
+     * curLogProb[j] is the log probability of the most probable state sequence
+     * ending at j, prevSeqState[j] is the previous state of that sequence.
+     */
+    void CalcViterbiRow(const CompiledModel& model, bool useSparse, size_t stepNumber, size_t symbol,
+                        const double* prevLogProb, double* curLogProb, size_t* prevSeqState)
+    {
+        const SparseEmissionTable& emissionTable = model.stateSymbolProb;
+        size_t nstates = model.nstates;
+        bool useTransfer = (! useSparse && ! model.logTransferProb.empty());
+
+        std::fill(curLogProb, curLogProb + nstates, LOG_ZERO);
+        std::fill(prevSeqState, prevSeqState + nstates, UNDEFINED_STATE);
+
+        for (size_t k = emissionTable.columnStart[symbol]; k < emissionTable.columnStart[symbol + 1]; ++k) {
+            size_t curState = emissionTable.columnState[k];
+            double bestLogProb = LOG_ZERO;
+            size_t bestPrevState = UNDEFINED_STATE;
+
+            if (stepNumber == 0) {
+                bestLogProb = model.logInitialProb[curState];
+            } else if (useSparse) {
+                for (size_t p = model.predecessorStart[curState]; p < model.predecessorStart[curState + 1]; ++p) {
+                    double curLog = prevLogProb[model.predecessorState[p]] + model.logPredecessorProb[p];
+
+                    if (curLog > bestLogProb) {
+                        bestLogProb = curLog;
+                        bestPrevState = model.predecessorState[p];
+                    }
+                }
+            } else {
+                const double* logTransition = (useTransfer ?
+                                               &model.logTransferProb[k * nstates] :
+                                               &model.logTransitionProbTransposed[curState * nstates]);
+
+                for (size_t prevState = 0; prevState < nstates; ++prevState) {
+                    double curLog = prevLogProb[prevState] + logTransition[prevState];
+
+                    if (curLog > bestLogProb) {
+                        bestLogProb = curLog;
+                        bestPrevState = prevState;
+                    }
+                }
+            }
+
+            // transfer tables already include emission
+            if (stepNumber == 0 || ! useTransfer) {
+                bestLogProb += model.logColumnProb[k];
+            }
+
+            curLogProb[curState] = bestLogProb;
+            prevSeqState[curState] = bestPrevState;
+        }
+    }
+
+    /**
+     * \brief Aux. function to calculate backward probabilities of the eliminated model states
+     *
+     * \details
+     * Eliminated states are never occupied, but their backward probabilities are
+     * well defined and reported by CalcForwardBackwardProbabiliies for completeness.
+     */
+    void CalcEliminatedBackward(const CompiledModel& model, const double* nextSymbolEmission,
+                                const double* nextBackward, double* eliminatedBackward)
+    {
+        for (size_t d = 0; d < model.eliminatedStates.size(); ++d) {
+            double nextCumulativeProb = 0.;
+
+            for (size_t p = model.eliminatedStart[d]; p < model.eliminatedStart[d + 1]; ++p) {
+                size_t nextState = model.eliminatedSuccessor[p];
+                nextCumulativeProb += (model.eliminatedProb[p] *
+                                       nextSymbolEmission[nextState] *
+                                       nextBackward[nextState]);
+            }
+
+            eliminatedBackward[d] = nextCumulativeProb;
+        }
+    }
+
+    /**
+     * \brief Aux. function to expand sparse emission column of the symbol into dense per-state row
+     */
+    void FillSymbolEmission(const CompiledModel& model, size_t symbol, double* symbolEmission)
+    {
+        const SparseEmissionTable& emissionTable = model.stateSymbolProb;
+
+        std::fill(symbolEmission, symbolEmission + model.nstates, 0.);
+
+        for (size_t k = emissionTable.columnStart[symbol]; k < emissionTable.columnStart[symbol + 1]; ++k) {
+            symbolEmission[emissionTable.columnState[k]] = emissionTable.columnProb[k];
+        }
+    }
+
+    /**
+     * \brief Aux. function to join normalised forward and backward rows into the posterior row
+     *
+     * \details
+     * Posterior row is written in model state indices, eliminated states get zero probability.
+     */
+    void CalcPosteriorRow(const CompiledModel& model, const double* forward, const double* backward,
+                          double* posterior)
+    {
+        std::fill(posterior, posterior + model.nmodelStates, 0.);
+
+        for (size_t curState = 0; curState < model.nstates; ++curState) {
+            posterior[model.compiledToOriginal[curState]] = forward[curState] * backward[curState];
+        }
+
+        NormaliseRow(posterior, model.nmodelStates);
+    }
+
+    /**
+     * \brief Aux. function to resize the table to nrows x ncols zero pairs reusing the spare rows
+     *
+     * \details
+     * Rows removed from the table are moved into the spare rows with their storage,
+     * so the table may grow back without allocations.
+     */
+    void ResizeRows(vector<vector<pair<double, double> > >& rows,
+                    vector<vector<pair<double, double> > >& spareRows, size_t nrows, size_t ncols)
+    {
+        while (rows.size() > nrows) {
+            spareRows.push_back(std::move(rows.back()));
+            rows.pop_back();
+        }
+
+        while (rows.size() < nrows) {
+            if (spareRows.empty()) {
+                rows.push_back(vector<pair<double, double> > ());
+            } else {
+                rows.push_back(std::move(spareRows.back()));
+                spareRows.pop_back();
+            }
+        }
+
+        for (size_t i = 0; i < nrows; ++i) {
+            rows[i].assign(ncols, pair<double, double> (0., 0.));
+        }
+    }
+
+    /**
+     * \brief Aux. function to get arena bytes taken by the array, including alignment padding
+     */
+    size_t ArrayBytes(size_t n, size_t elementSize)
+    {
+        size_t alignment = HMM::Memory::TABLE_ALIGNMENT;
+
+        return (n * elementSize + alignment - 1) / alignment * alignment;
+    }
+
+    /// default segment length of the checkpointed Viterbi algorithm
+    size_t CheckpointSteps(size_t maxtime)
+    {
+        return std::max<size_t> (static_cast<size_t> (std::ceil(std::sqrt(static_cast<double> (maxtime)))), 1);
+    }
+
+    /**
+     * \brief Aux. function to check whether the variant fits into the workspace memory budget
+     */
+    bool FitsMemoryBudget(const Workspace& workspace, const CompiledModel& model, size_t nsteps,
+                          HMM::Algorithms::Variant variant, size_t blockSteps = 0)
+    {
+        return (workspace.memoryBudget == 0 ||
+                HMM::Algorithms::EstimatePeakBytes(model, nsteps, variant, blockSteps) <= workspace.memoryBudget);
+    }
+
+    bool UseSparseKernel(const CompiledModel& model, const Workspace& workspace)
+    {
+        switch (workspace.kernel) {
+        case HMM::Algorithms::Kernel::Dense:
+            return false;
+        case HMM::Algorithms::Kernel::Sparse:
+            return true;
+        default:
+            return model.preferSparse;
+        }
+    }
+
+    /**
+     * \brief Aux. function to fail fast if the variant does not fit into the workspace memory budget
+     */
+    void CheckMemoryBudget(const Workspace& workspace, const CompiledModel& model, size_t nsteps,
+                           HMM::Algorithms::Variant variant, size_t blockSteps = 0)
+    {
+        if (! FitsMemoryBudget(workspace, model, nsteps, variant, blockSteps)) {
+            throw std::length_error("Estimated memory of " +
+                                    std::to_string(HMM::Algorithms::EstimatePeakBytes(model, nsteps, variant,
+                                                                                      blockSteps)) +
+                                    " bytes exceeds the budget of " + std::to_string(workspace.memoryBudget) +
+                                    " bytes");
+        }
+    }
+};
+
+vector<size_t>
+HMM::Algorithms::FindMostProbableStateSequence(const Model& model, const ExperimentData& data)
+{
+    return FindMostProbableStateSequence(model, data.SymbolColumn());
+}
+
+vector<size_t>
+HMM::Algorithms::FindMostProbableStateSequence(const Model& model, const ColumnView& symbols)
+{
+    CompiledModel compiledModel;
+    compiledModel.Compile(model);
+
+    return FindMostProbableStateSequence(compiledModel, symbols);
+}
+
+vector<size_t>
+HMM::Algorithms::FindMostProbableStateSequence(const CompiledModel& model, const ColumnView& symbols)
+{
+    Workspace workspace;
+    FindMostProbableStateSequence(model, symbols, workspace);
+
+    return std::move(workspace.mostProbableSeq);
+}
+
+const vector<size_t>&
+HMM::Algorithms::FindMostProbableStateSequence(const CompiledModel& model, const ColumnView& symbols,
+                                               Workspace& workspace)
+{
+    FindMostProbableStateSequence(model, symbols, workspace, workspace.mostProbableSeq);
+
+    return workspace.mostProbableSeq;
+}
+
+void HMM::Algorithms::FindMostProbableStateSequence(const CompiledModel& model, const ColumnView& symbols,
+                                                    Workspace& workspace, vector<size_t>& mostProbableSeq)
+{
+    // section: prepare and initialize data structures for calculations
+    size_t nstates = model.nstates;
+    size_t maxtime = symbols.size();
+
+    bool useSparse = UseSparseKernel(model, workspace);
+
+    if (! FitsMemoryBudget(workspace, model, maxtime, Variant::Viterbi)) {
+        CheckMemoryBudget(workspace, model, maxtime, Variant::CheckpointedViterbi);
+        FindMostProbableStateSequenceCheckpointed(model, symbols, workspace, mostProbableSeq);
+        return;
+    }
+
+    workspace.arena.Reset();
+
+    /**
+     * \note
+     * prevLogProb[j] and curLogProb[j] are the log probabilities of the most probable sequence
+     * of states for the previous and current observations for which the last state is j-th.
+     * Only two rows are kept, the whole sequence is recovered from backpointers.
+     */
+    double* prevLogProb = workspace.arena.AllocateArray(nstates, LOG_ZERO);
+    double* curLogProb = workspace.arena.AllocateArray(nstates, LOG_ZERO);
+
+    /**
+     * \note
+     * prevSeqState[i * nstates + j] is the previous state from which the most probable
+     * sequence for 1..i observations with the last state at j has been formed.
+     * This information will help to recover the whole sequence.
+     * Every row is filled by CalcViterbiRow, so the table is not initialised.
+     */
+    size_t* prevSeqState = static_cast<size_t*> (workspace.arena.Allocate(maxtime * nstates * sizeof(size_t)));
+
+    // section: calculate probabilities for Viterbi algorithm using dynamic programming approach
+    for (size_t t = 0; t < maxtime; ++t) {
+        CalcViterbiRow(model, useSparse, t, model.symbolToCompiled[symbols[t]], prevLogProb, curLogProb,
+                       prevSeqState + t * nstates);
+        std::swap(prevLogProb, curLogProb);
+    }
+
+    // section: find the last state of the most probable sequence to start recovery from it
+    mostProbableSeq.assign(maxtime, 0);
+
+    if (nstates == 0) {
+        return;
+    }
+
+    size_t curState = std::distance(prevLogProb, std::max_element(prevLogProb, prevLogProb + nstates));
+
+    if (prevLogProb[curState] == LOG_ZERO) {
+        // no state sequence can emit the observations
+        return;
+    }
+
+    // section: collect most probable sequence in the reverse order
+    for (size_t t = maxtime; t-- > 0;) {
+        mostProbableSeq[t] = model.compiledToOriginal[curState];
+        curState = prevSeqState[t * nstates + curState];
+    }
+}
+
+void HMM::Algorithms::FindMostProbableStateSequenceCheckpointed(const CompiledModel& model, const ColumnView& symbols,
+                                                                Workspace& workspace,
+                                                                vector<size_t>& mostProbableSeq,
+                                                                size_t segmentSteps)
+{
+    // section: prepare and initialize data structures for calculations
+    size_t nstates = model.nstates;
+    size_t maxtime = symbols.size();
+
+    if (segmentSteps == 0) {
+        segmentSteps = CheckpointSteps(maxtime);
+    }
+
+    size_t nsegments = (maxtime + segmentSteps - 1) / segmentSteps;
+    HMM::Memory::Arena& arena = workspace.arena;
+    bool useSparse = UseSparseKernel(model, workspace);
+
+    arena.Reset();
+
+    double* prevLogProb = arena.AllocateArray(nstates, LOG_ZERO);
+    double* curLogProb = arena.AllocateArray(nstates, LOG_ZERO);
+
+    /**
+     * \note
+     * checkpointLogProb[k * nstates + j] is the log probability of the most probable sequence
+     * ending at j at the last step before the k-th segment, the row of the first segment is unused.
+     * prevSeqState keeps backpointers of one segment, rows are filled by CalcViterbiRow.
+     */
+    double* checkpointLogProb = arena.AllocateArray(nsegments * nstates, LOG_ZERO);
+    size_t* prevSeqState = static_cast<size_t*> (arena.Allocate(segmentSteps * nstates * sizeof(size_t)));
+
+    // section: first pass keeps log probabilities at the segment boundaries only
+    for (size_t t = 0; t < maxtime; ++t) {
+        CalcViterbiRow(model, useSparse, t, model.symbolToCompiled[symbols[t]], prevLogProb, curLogProb,
+                       prevSeqState);
+        std::swap(prevLogProb, curLogProb);
+
+        if ((t + 1) % segmentSteps == 0 && t + 1 < maxtime) {
+            std::copy(prevLogProb, prevLogProb + nstates, checkpointLogProb + (t + 1) / segmentSteps * nstates);
+        }
+    }
+
+    // section: find the last state of the most probable sequence to start recovery from it
+    mostProbableSeq.assign(maxtime, 0);
+
+    if (nstates == 0 || maxtime == 0) {
+        return;
+    }
+
+    size_t curState = std::distance(prevLogProb, std::max_element(prevLogProb, prevLogProb + nstates));
+
+    if (prevLogProb[curState] == LOG_ZERO) {
+        // no state sequence can emit the observations
+        return;
+    }
+
+    // section: recompute backpointers segment by segment in reverse order and collect the sequence
+    for (size_t segment = nsegments; segment-- > 0;) {
+        size_t firstStep = segment * segmentSteps;
+        size_t lastStep = std::min(firstStep + segmentSteps, maxtime);
+
+        std::copy(checkpointLogProb + segment * nstates, checkpointLogProb + (segment + 1) * nstates,
+                  prevLogProb);
+
+        for (size_t t = firstStep; t < lastStep; ++t) {
+            CalcViterbiRow(model, useSparse, t, model.symbolToCompiled[symbols[t]], prevLogProb, curLogProb,
+                           prevSeqState + (t - firstStep) * nstates);
+            std::swap(prevLogProb, curLogProb);
+        }
+
+        for (size_t t = lastStep; t-- > firstStep;) {
+            mostProbableSeq[t] = model.compiledToOriginal[curState];
+            curState = prevSeqState[(t - firstStep) * nstates + curState];
+        }
+    }
+}
+
+size_t HMM::Algorithms::EstimatePeakBytes(const CompiledModel& model, size_t nsteps, Variant variant,
+                                          size_t blockSteps)
+{
+    size_t nstates = model.nstates;
+    size_t rowBytes = ArrayBytes(nstates, sizeof(double));
+
+    // arena may keep its first small block besides the block of the tables
+    size_t peakBytes = HMM::Memory::MIN_ARENA_BLOCK_BYTES;
+
+    switch (variant) {
+    case Variant::Viterbi:
+        peakBytes += 2 * rowBytes + ArrayBytes(nsteps * nstates, sizeof(size_t)) + nsteps * sizeof(size_t);
+        break;
+    case Variant::CheckpointedViterbi:
+    {
+        size_t segmentSteps = CheckpointSteps(nsteps);
+        size_t nsegments = (nsteps + segmentSteps - 1) / segmentSteps;
+
+        peakBytes += (2 * rowBytes + ArrayBytes(nsegments * nstates, sizeof(double)) +
+                      ArrayBytes(segmentSteps * nstates, sizeof(size_t)) + nsteps * sizeof(size_t));
+        break;
+    }
+    case Variant::ForwardBackward:
+        peakBytes += (5 * rowBytes + ArrayBytes(model.eliminatedStates.size(), sizeof(double)) +
+                      nsteps * (sizeof(vector<pair<double, double> >) +
+                                model.nmodelStates * sizeof(pair<double, double>)));
+        break;
+    case Variant::StreamingPosteriors:
+        blockSteps = std::min(blockSteps == 0 ? DEFAULT_BLOCK_STEPS : blockSteps, nsteps);
+        peakBytes += (ArrayBytes(nsteps * nstates, sizeof(double)) + 2 * rowBytes +
+                      ArrayBytes(blockSteps * model.nmodelStates, sizeof(double)));
+        break;
+    case Variant::OutOfCorePosteriors:
+        // resident mapped window of the scratch file is included
+        blockSteps = std::min(blockSteps == 0 ? DEFAULT_WINDOW_STEPS : blockSteps, nsteps);
+        peakBytes += (3 * rowBytes + ArrayBytes(blockSteps * model.nmodelStates, sizeof(double)) +
+                      blockSteps * std::max<size_t> (nstates, 1) * sizeof(double));
+        break;
+    }
+
+    return peakBytes;
+}
+
+vector<vector<pair<double, double> > >
+HMM::Algorithms::CalcForwardBackwardProbabiliies(const Model& model, const ExperimentData& data)
+{
+    return CalcForwardBackwardProbabiliies(model, data.SymbolColumn());
+}
+
+vector<vector<pair<double, double> > >
+HMM::Algorithms::CalcForwardBackwardProbabiliies(const Model& model, const ColumnView& symbols)
+{
+    CompiledModel compiledModel;
+    compiledModel.Compile(model);
+
+    return CalcForwardBackwardProbabiliies(compiledModel, symbols);
+}
+
+vector<vector<pair<double, double> > >
+HMM::Algorithms::CalcForwardBackwardProbabiliies(const CompiledModel& model, const ColumnView& symbols)
+{
+    Workspace workspace;
+    CalcForwardBackwardProbabiliies(model, symbols, workspace);
+
+    return std::move(workspace.forwardBackwardProb);
+}
+
+const vector<vector<pair<double, double> > >&
+HMM::Algorithms::CalcForwardBackwardProbabiliies(const CompiledModel& model, const ColumnView& symbols,
+                                                 Workspace& workspace)
+{
+    size_t nstates = model.nstates;
+    size_t maxtime = symbols.size();
+    HMM::Memory::Arena& arena = workspace.arena;
+
+    // full result table has no lower-memory variant
+    CheckMemoryBudget(workspace, model, maxtime, Variant::ForwardBackward);
+    arena.Reset();
+
+    /**
+     * \note
+     * forwardBackwardProbability[i][j] joins forward probability (the probability that any hidden
+     * sequence with the hidden state at i-th step equal to j describes first 1..i observations)
+     * and backward probability (the probability that any hidden sequence with the hidden state
+     * at i-th step equal to j describes last i+1..T observations).
+     */
+    vector<vector<pair<double, double> > >& forwardBackwardProbability = workspace.forwardBackwardProb;
+    ResizeRows(forwardBackwardProbability, workspace.spareRows, maxtime, model.nmodelStates);
+
+    // passes may run concurrently, so all their rows are taken from the arena in advance
+    double* prevForward = arena.AllocateArray(nstates, 0.);
+    double* curForward = arena.AllocateArray(nstates, 0.);
+    double* nextBackward = arena.AllocateArray(nstates, 1.);
+    double* curBackward = arena.AllocateArray(nstates, 1.);
+    double* eliminatedBackward = arena.AllocateArray(model.eliminatedStates.size(), 1.);
+    double* symbolEmission = arena.AllocateArray(nstates, 0.);
+    bool useSparse = UseSparseKernel(model, workspace);
+
+    // section: calculate forward probabilities of the forward-backward algorithm
+    auto forwardPass = [&]()
+    {
+        for (size_t t = 0; t < maxtime; ++t) {
+            CalcForwardRow(model, useSparse, t, model.symbolToCompiled[symbols[t]], prevForward, curForward);
+
+            for (size_t curState = 0; curState < nstates; ++curState) {
+                forwardBackwardProbability[t][model.compiledToOriginal[curState]].first = curForward[curState];
+            }
+
+            std::swap(prevForward, curForward);
+        }
+    };
+
+    // forward pass writes only the first members of the pairs, backward pass only the second ones
+    std::thread forwardThread;
+
+    if (workspace.parallelPasses) {
+        forwardThread = std::thread(forwardPass);
+    } else {
+        forwardPass();
+    }
+
+    // section: calculate backward probabilities of the forward-backward algorithm
+    for (size_t t = maxtime; t-- > 0;) {
+        // probability to describe empty sequence is 1.
+        if (t + 1 < maxtime) {
+            CalcBackwardRow(model, useSparse, model.symbolToCompiled[symbols[t + 1]],
+                            nextBackward, curBackward);
+            FillSymbolEmission(model, model.symbolToCompiled[symbols[t + 1]], symbolEmission);
+            CalcEliminatedBackward(model, symbolEmission, nextBackward, eliminatedBackward);
+        }
+
+        for (size_t curState = 0; curState < nstates; ++curState) {
+            forwardBackwardProbability[t][model.compiledToOriginal[curState]].second = curBackward[curState];
+        }
+
+        for (size_t d = 0; d < model.eliminatedStates.size(); ++d) {
+            forwardBackwardProbability[t][model.eliminatedStates[d]].second = eliminatedBackward[d];
+        }
+
+        std::swap(nextBackward, curBackward);
+    }
+
+    if (forwardThread.joinable()) {
+        forwardThread.join();
+    }
+
+    return forwardBackwardProbability;
+}
+
+void HMM::Algorithms::StreamPosteriorProbabilities(const Model& model, const ExperimentData& data,
+                                                   PosteriorSink& sink, size_t blockSteps)
+{
+    StreamPosteriorProbabilities(model, data.SymbolColumn(), sink, blockSteps);
+}
+
+void HMM::Algorithms::StreamPosteriorProbabilities(const Model& model, const ColumnView& symbols,
+                                                   PosteriorSink& sink, size_t blockSteps)
+{
+    CompiledModel compiledModel;
+    compiledModel.Compile(model);
+
+    StreamPosteriorProbabilities(compiledModel, symbols, sink, blockSteps);
+}
+
+void HMM::Algorithms::StreamPosteriorProbabilities(const CompiledModel& model, const ColumnView& symbols,
+                                                   PosteriorSink& sink, size_t blockSteps)
+{
+    Workspace workspace;
+
+    StreamPosteriorProbabilities(model, symbols, sink, workspace, blockSteps);
+}
+
+double HMM::Algorithms::StreamPosteriorProbabilities(const CompiledModel& model, const ColumnView& symbols,
+                                                     PosteriorSink& sink, Workspace& workspace,
+                                                     size_t blockSteps)
+{
+    size_t nstates = model.nstates;
+    size_t maxtime = symbols.size();
+    HMM::Memory::Arena& arena = workspace.arena;
+    bool useSparse = UseSparseKernel(model, workspace);
+
+    if (blockSteps == 0) {
+        throw std::invalid_argument("Posterior block must contain at least one step");
+    }
+
+    // an empty sequence has no posteriors, the tables are indexed by its last step below
+    if (maxtime == 0) {
+        return 0;
+    }
+
+    // out-of-core variant needs a scratch directory, so it is not chosen automatically
+    CheckMemoryBudget(workspace, model, maxtime, Variant::StreamingPosteriors, blockSteps);
+    arena.Reset();
+
+    /**
+     * \note
+     * backwardStateProbability[i * nstates + j] is proportional to the backward probability
+     * of state j at the i-th step, each row is normalised to avoid underflow,
+     * which does not change posteriors.
+     */
+    double* backwardStateProbability = arena.AllocateArray(maxtime * nstates, 1.);
+
+    // section: calculate normalised backward probabilities
+    NormaliseRow(backwardStateProbability + (maxtime - 1) * nstates, nstates);
+
+    for (size_t t = maxtime - 1; t-- > 0;) {
+        double* curBackward = backwardStateProbability + t * nstates;
+
+        CalcBackwardRow(model, useSparse, model.symbolToCompiled[symbols[t + 1]],
+                        curBackward + nstates, curBackward);
+        NormaliseRow(curBackward, nstates);
+    }
+
+    // section: calculate normalised forward probabilities and pass joined posteriors by blocks
+    double* prevForward = arena.AllocateArray(nstates, 0.);
+    double* curForward = arena.AllocateArray(nstates, 0.);
+    double* block = arena.AllocateArray(std::min(blockSteps, maxtime) * model.nmodelStates, 0.);
+    size_t blockFirstStep = 0;
+    double logLikelihood = 0;
+
+    for (size_t t = 0; t < maxtime; ++t) {
+        CalcForwardRow(model, useSparse, t, model.symbolToCompiled[symbols[t]], prevForward, curForward);
+
+        double scale = NormaliseRow(curForward, nstates);
+
+        // the sequence is impossible, rows of zeros stay zero till the end
+        if (scale == 0) {
+            logLikelihood = -std::numeric_limits<double>::infinity();
+        } else {
+            logLikelihood += std::log(scale);
+        }
+
+        CalcPosteriorRow(model, curForward, backwardStateProbability + t * nstates,
+                         block + (t - blockFirstStep) * model.nmodelStates);
+        std::swap(prevForward, curForward);
+
+        if (t + 1 - blockFirstStep == blockSteps || t + 1 == maxtime) {
+            sink.ConsumePosteriors(blockFirstStep, t + 1 - blockFirstStep, model.nmodelStates, block);
+            blockFirstStep = t + 1;
+        }
+    }
+
+    return logLikelihood;
+}
+
+void HMM::Algorithms::StreamPosteriorProbabilitiesOutOfCore(const Model& model,
+                                                            const ExperimentData& data,
+                                                            PosteriorSink& sink,
+                                                            const std::string& scratchDirectory,
+                                                            size_t windowSteps)
+{
+    StreamPosteriorProbabilitiesOutOfCore(model, data.SymbolColumn(), sink, scratchDirectory, windowSteps);
+}
+
+void HMM::Algorithms::StreamPosteriorProbabilitiesOutOfCore(const Model& model,
+                                                            const ColumnView& symbols,
+                                                            PosteriorSink& sink,
+                                                            const std::string& scratchDirectory,
+                                                            size_t windowSteps)
+{
+    CompiledModel compiledModel;
+    compiledModel.Compile(model);
+
+    StreamPosteriorProbabilitiesOutOfCore(compiledModel, symbols, sink, scratchDirectory, windowSteps);
+}
+
+void HMM::Algorithms::StreamPosteriorProbabilitiesOutOfCore(const CompiledModel& model,
+                                                            const ColumnView& symbols,
+                                                            PosteriorSink& sink,
+                                                            const std::string& scratchDirectory,
+                                                            size_t windowSteps)
+{
+    Workspace workspace;
+
+    StreamPosteriorProbabilitiesOutOfCore(model, symbols, sink, workspace, scratchDirectory, windowSteps);
+}
+
+void HMM::Algorithms::StreamPosteriorProbabilitiesOutOfCore(const CompiledModel& model,
+                                                            const ColumnView& symbols,
+                                                            PosteriorSink& sink,
+                                                            Workspace& workspace,
+                                                            const std::string& scratchDirectory,
+                                                            size_t windowSteps)
+{
+    size_t nstates = model.nstates;
+    HMM::Memory::Arena& arena = workspace.arena;
+    bool useSparse = UseSparseKernel(model, workspace);
+    size_t maxtime = symbols.size();
+    size_t rowBytes = std::max<size_t> (nstates, 1) * sizeof(double);
+
+    if (windowSteps == 0) {
+        throw std::invalid_argument("Scratch window must contain at least one step");
+    }
+
+    // an empty sequence has no posteriors and would need a zero-length scratch mapping
+    if (maxtime == 0) {
+        return;
+    }
+
+    CheckMemoryBudget(workspace, model, maxtime, Variant::OutOfCorePosteriors, windowSteps);
+    arena.Reset();
+
+    /**
+     * \note
+     * Scratch file keeps normalised forward probabilities as maxtime x nstates row-major table,
+     * only the current window of windowSteps rows is mapped into memory.
+     */
+    HMM::Memory::ScratchFile forwardStateProbability(scratchDirectory, maxtime * rowBytes);
+    double* prevForward = arena.AllocateArray(nstates, 0.);
+
+    // section: calculate normalised forward probabilities window by window
+    for (size_t windowFirstStep = 0; windowFirstStep < maxtime; windowFirstStep += windowSteps) {
+        size_t windowSize = std::min(windowSteps, maxtime - windowFirstStep);
+        double* window = static_cast<double*> (
+            forwardStateProbability.MapWindow(windowFirstStep * rowBytes, windowSize * rowBytes));
+
+        for (size_t t = windowFirstStep; t < windowFirstStep + windowSize; ++t) {
+            double* curForward = window + (t - windowFirstStep) * nstates;
+
+            CalcForwardRow(model, useSparse, t, model.symbolToCompiled[symbols[t]], prevForward, curForward);
+            NormaliseRow(curForward, nstates);
+            std::copy(curForward, curForward + nstates, prevForward);
+        }
+    }
+
+    // section: stream forward windows back in reverse order along the backward pass
+    double* nextBackward = arena.AllocateArray(nstates, 1.);
+    double* curBackward = arena.AllocateArray(nstates, 1.);
+    double* block = arena.AllocateArray(std::min(windowSteps, maxtime) * model.nmodelStates, 0.);
+    size_t nwindows = (maxtime + windowSteps - 1) / windowSteps;
+
+    NormaliseRow(curBackward, nstates);
+
+    for (size_t windowInd = nwindows; windowInd-- > 0;) {
+        size_t windowFirstStep = windowInd * windowSteps;
+        size_t windowSize = std::min(windowSteps, maxtime - windowFirstStep);
+        const double* window = static_cast<const double*> (
+            forwardStateProbability.MapWindow(windowFirstStep * rowBytes, windowSize * rowBytes));
+
+        for (size_t t = windowFirstStep + windowSize; t-- > windowFirstStep;) {
+            if (t + 1 < maxtime) {
+                CalcBackwardRow(model, useSparse, model.symbolToCompiled[symbols[t + 1]],
+                                nextBackward, curBackward);
+                NormaliseRow(curBackward, nstates);
+            }
+
+            CalcPosteriorRow(model, window + (t - windowFirstStep) * nstates, curBackward,
+                             block + (t - windowFirstStep) * model.nmodelStates);
+            std::swap(nextBackward, curBackward);
+        }
+
+        sink.ConsumePosteriors(windowFirstStep, windowSize, model.nmodelStates, block);
+    }
+}
+
+void HMM::Algorithms::PosteriorFanout::Add(PosteriorSink& sink)
+{
+    sinks.push_back(&sink);
+}
+
+void HMM::Algorithms::PosteriorFanout::ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                                         const double* posteriors)
+{
+    for (size_t i = 0; i < sinks.size(); ++i) {
+        sinks[i]->ConsumePosteriors(firstStep, nsteps, nstates, posteriors);
+    }
+}
+
+double HMM::Algorithms::CalcLogLikelihood(const CompiledModel& model, const ColumnView& symbols,
+                                          Workspace& workspace)
+{
+    size_t nstates = model.nstates;
+    HMM::Memory::Arena& arena = workspace.arena;
+    bool useSparse = UseSparseKernel(model, workspace);
+
+    arena.Reset();
+
+    double* prevForward = arena.AllocateArray(nstates, 0.);
+    double* curForward = arena.AllocateArray(nstates, 0.);
+    double logLikelihood = 0;
+
+    for (size_t t = 0; t < symbols.size(); ++t) {
+        CalcForwardRow(model, useSparse, t, model.symbolToCompiled[symbols[t]], prevForward, curForward);
+
+        double scale = NormaliseRow(curForward, nstates);
+
+        if (scale == 0) {
+            return -std::numeric_limits<double>::infinity();
+        }
+
+        logLikelihood += std::log(scale);
+        std::swap(prevForward, curForward);
+    }
+
+    return logLikelihood;
+}
+//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< end of Algorithms namespace definitions <<<<<<<<<<<<<<<<<<<<
+
+
+//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> Estimation namespace definitions >>>>>>>>>>>>>>>>>>>>>>>>>>>
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ */
+namespace
+{
+    /**
+     * \brief Aux. function to make the matrix nrows x ncols of zeros reusing its storage
+     */
+    void ResetMatrix(vector<vector<size_t> >& matrix, size_t nrows, size_t ncols)
+    {
+        matrix.resize(nrows);
+
+        for (size_t i = 0; i < nrows; ++i) {
+            matrix[i].assign(ncols, 0);
+        }
+    }
+
+    /// number of steps compared at once while looking for state changes
+    const size_t SEGMENT_SCAN_CHUNK_STEPS = 64;
+
+    void CountConfusions(const ColumnView& realStates, const vector<size_t>& predictedStates,
+                         size_t nstates, vector<vector<size_t> >& confusionMatrix)
+    {
+        ResetMatrix(confusionMatrix, nstates, nstates);
+
+        for (size_t t = 0; t < predictedStates.size(); ++t) {
+            size_t predictedInd = predictedStates[t];
+            size_t realInd      = realStates[t];
+
+            ++confusionMatrix[predictedInd][realInd];
+        }
+    }
+};
+
+vector<size_t> HMM::Estimation::GetMostProbableStates(
+    const vector<vector<pair<double, double> > >& forwardBackwardProb)
+{
+    vector<size_t> mostProbableStates;
+    GetMostProbableStates(forwardBackwardProb, mostProbableStates);
+
+    return mostProbableStates;
+}
+
+void HMM::Estimation::GetMostProbableStates(const vector<vector<pair<double, double> > >& forwardBackwardProb,
+                                            vector<size_t>& mostProbableStates)
+{
+    size_t maxtime = forwardBackwardProb.size();
+
+    mostProbableStates.resize(maxtime);
+
+    for (size_t t = 0; t < maxtime; ++t) {
+        size_t mostProbableState =
+            std::distance(std::begin(forwardBackwardProb[t]),
+                          std::max_element(std::begin(forwardBackwardProb[t]),
+                                           std::end(forwardBackwardProb[t]),
+                                           [](const pair<double, double>& prev,
+                                              const pair<double, double>& next)
+                                           {return (prev.first * prev.second <
+                                                    next.first * next.second);}));
+        mostProbableStates[t] = mostProbableState;
+    }
+}
+
+HMM::Estimation::MostProbableStatesSink::MostProbableStatesSink(vector<size_t>& mostProbableStates)
+    : mostProbableStates(mostProbableStates)
+{
+}
+
+void HMM::Estimation::MostProbableStatesSink::ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                                                const double* posteriors)
+{
+    for (size_t t = 0; t < nsteps; ++t) {
+        const double* row = posteriors + t * nstates;
+
+        mostProbableStates[firstStep + t] = std::distance(row, std::max_element(row, row + nstates));
+    }
+}
+
+vector<vector<size_t> >
+HMM::Estimation::CombineConfusionMatrix(const ExperimentData& realData,
+                                        const vector<size_t>& predictedStates,
+                                        const Model& model)
+{
+    return CombineConfusionMatrix(realData.StateColumn(), predictedStates, model);
+}
+
+vector<vector<size_t> >
+HMM::Estimation::CombineConfusionMatrix(const ColumnView& realStates,
+                                        const vector<size_t>& predictedStates,
+                                        const Model& model)
+{
+    vector<vector<size_t> > confusionMatrix;
+    CombineConfusionMatrix(realStates, predictedStates, model, confusionMatrix);
+
+    return confusionMatrix;
+}
+
+vector<vector<size_t> >
+HMM::Estimation::CombineConfusionMatrix(const ColumnView& realStates,
+                                        const vector<size_t>& predictedStates,
+                                        const CompiledModel& model)
+{
+    vector<vector<size_t> > confusionMatrix;
+    CombineConfusionMatrix(realStates, predictedStates, model, confusionMatrix);
+
+    return confusionMatrix;
+}
+
+void HMM::Estimation::CombineConfusionMatrix(const ColumnView& realStates,
+                                             const vector<size_t>& predictedStates,
+                                             const Model& model,
+                                             vector<vector<size_t> >& confusionMatrix)
+{
+    CountConfusions(realStates, predictedStates, model.transitionProb.size(), confusionMatrix);
+}
+
+void HMM::Estimation::CombineConfusionMatrix(const ColumnView& realStates,
+                                             const vector<size_t>& predictedStates,
+                                             const CompiledModel& model,
+                                             vector<vector<size_t> >& confusionMatrix)
+{
+    CountConfusions(realStates, predictedStates, model.nmodelStates, confusionMatrix);
+}
+
+HMM::Estimation::ConfusionAccumulator::ConfusionAccumulator(size_t nstates)
+{
+    Reset(nstates);
+}
+
+void HMM::Estimation::ConfusionAccumulator::Reset(size_t nstates)
+{
+    ResetMatrix(confusionMatrix, nstates, nstates);
+}
+
+void HMM::Estimation::ConfusionAccumulator::Add(const ColumnView& realStates, size_t firstStep, size_t nsteps,
+                                                const size_t* predictedStates)
+{
+    for (size_t t = 0; t < nsteps; ++t) {
+        ++confusionMatrix[predictedStates[t]][realStates[firstStep + t]];
+    }
+}
+
+void HMM::Estimation::ConfusionAccumulator::Add(const ColumnView& realStates, const vector<size_t>& predictedStates)
+{
+    Add(realStates, 0, predictedStates.size(), predictedStates.data());
+}
+
+void HMM::Estimation::ConfusionAccumulator::Merge(const ConfusionAccumulator& other)
+{
+    size_t nstates = confusionMatrix.size();
+
+    if (other.confusionMatrix.size() != nstates) {
+        throw std::invalid_argument("Merged confusion matrices have different number of states");
+    }
+
+    for (size_t i = 0; i < nstates; ++i) {
+        std::transform(confusionMatrix[i].begin(), confusionMatrix[i].end(), other.confusionMatrix[i].begin(),
+                       confusionMatrix[i].begin(), std::plus<size_t>());
+    }
+}
+
+void HMM::Estimation::ConfusionAccumulator::Write(std::ostream& target) const
+{
+    target << confusionMatrix.size() << '\n';
+
+    for (size_t i = 0; i < confusionMatrix.size(); ++i) {
+        for (size_t j = 0; j < confusionMatrix[i].size(); ++j) {
+            target << (j == 0 ? "" : " ") << confusionMatrix[i][j];
+        }
+
+        target << '\n';
+    }
+}
+
+void HMM::Estimation::ConfusionAccumulator::Read(std::istream& source)
+{
+    size_t nstates = 0;
+    source >> nstates;
+
+    ConfusionAccumulator other(nstates);
+
+    for (size_t i = 0; i < nstates; ++i) {
+        for (size_t j = 0; j < nstates; ++j) {
+            source >> other.confusionMatrix[i][j];
+        }
+    }
+
+    if (source.fail()) {
+        throw std::invalid_argument("Malformed confusion matrix");
+    }
+
+    Merge(other);
+}
+
+HMM::Estimation::ConfusionSink::ConfusionSink(const ColumnView& realStates, ConfusionAccumulator& accumulator)
+    : realStates(realStates)
+    , accumulator(accumulator)
+{
+}
+
+void HMM::Estimation::ConfusionSink::ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                                       const double* posteriors)
+{
+    predictedStates.resize(nsteps);
+
+    for (size_t t = 0; t < nsteps; ++t) {
+        const double* row = posteriors + t * nstates;
+
+        predictedStates[t] = std::distance(row, std::max_element(row, row + nstates));
+    }
+
+    accumulator.Add(realStates, firstStep, nsteps, predictedStates.data());
+}
+
+void HMM::Estimation::ExtractSegments(const ColumnView& states, vector<StateSegment>& segments)
+{
+    size_t nsteps = states.size();
+    bool isContiguous = (states.stride == states.width);
+
+    segments.clear();
+
+    if (nsteps == 0) {
+        return;
+    }
+
+    StateSegment segment = {states[0], 0, 0};
+
+    for (size_t t = 1; t < nsteps;) {
+        // section: skip whole chunks without state changes
+        size_t chunkSteps = std::min(SEGMENT_SCAN_CHUNK_STEPS, nsteps - t);
+
+        if (isContiguous &&
+            std::memcmp(states.first + t * states.width, states.first + (t - 1) * states.width,
+                        chunkSteps * states.width) == 0) {
+            t += chunkSteps;
+            continue;
+        }
+
+        // section: locate state changes inside the chunk
+        for (size_t last = t + chunkSteps; t < last; ++t) {
+            size_t state = states[t];
+
+            if (state != segment.state) {
+                segment.endStep = t;
+                segments.push_back(segment);
+                segment.state = state;
+                segment.firstStep = t;
+            }
+        }
+    }
+
+    segment.endStep = nsteps;
+    segments.push_back(segment);
+}
+
+void HMM::Estimation::ExtractSegments(const vector<size_t>& states, vector<StateSegment>& segments)
+{
+    ExtractSegments(ColumnView(states.data(), states.size(), sizeof(size_t), sizeof(size_t)), segments);
+}
+
+void HMM::Estimation::GetSegmentEstimations(const vector<StateSegment>& realSegments,
+                                            const vector<StateSegment>& predictedSegments,
+                                            size_t nstates, size_t tolerance,
+                                            vector<PredictionEstimation>& estimations)
+{
+    // section: real segments of every state in the step order
+    vector<vector<StateSegment> > stateRealSegments(nstates);
+
+    for (size_t k = 0; k < realSegments.size(); ++k) {
+        stateRealSegments[realSegments[k].state].push_back(realSegments[k]);
+    }
+
+    // section: greedy matching, real segments starting too early for a predicted one can not match later ones
+    vector<size_t> nextReal(nstates, 0);
+    vector<size_t> matched(nstates, 0);
+    vector<size_t> npredicted(nstates, 0);
+
+    for (size_t k = 0; k < predictedSegments.size(); ++k) {
+        const StateSegment& predicted = predictedSegments[k];
+        const vector<StateSegment>& candidates = stateRealSegments[predicted.state];
+        size_t& r = nextReal[predicted.state];
+
+        ++npredicted[predicted.state];
+
+        while (r < candidates.size() && candidates[r].firstStep + tolerance < predicted.firstStep) {
+            ++r;
+        }
+
+        if (r < candidates.size() &&
+            candidates[r].firstStep <= predicted.firstStep + tolerance &&
+            candidates[r].endStep <= predicted.endStep + tolerance &&
+            predicted.endStep <= candidates[r].endStep + tolerance) {
+            ++matched[predicted.state];
+            ++r;
+        }
+    }
+
+    // section: estimations of the matches
+    estimations.resize(nstates);
+
+    for (size_t state = 0; state < nstates; ++state) {
+        PredictionEstimation& estimation = estimations[state];
+        size_t nreal = stateRealSegments[state].size();
+        double tp = static_cast<double> (matched[state]);
+
+        estimation.truePositives = matched[state];
+        estimation.falsePositives = npredicted[state] - matched[state];
+        estimation.trueNegatives = 0;
+        estimation.falseNegatives = nreal - matched[state];
+        estimation.precision = (npredicted[state] != 0 ? tp / static_cast<double> (npredicted[state]) : 0.);
+        estimation.recall = (nreal != 0 ? tp / static_cast<double> (nreal) : 0.);
+        estimation.fMeasure = (matched[state] != 0 ?
+                               2. * tp / static_cast<double> (npredicted[state] + nreal) : 0.);
+        estimation.fBeta = estimation.fMeasure;
+    }
+}
+
+HMM::Estimation::PosteriorCalibration::PosteriorCalibration(size_t nstates, size_t nbins,
+                                                            const ColumnView& realStates)
+    : nstates(nstates)
+    , nbins(std::max<size_t> (nbins, 1))
+    , realStates(realStates)
+    , expectedCounts(nstates * nstates, 0.)
+{
+    Bin emptyBin = {0, 0., 0};
+    bins.assign(nstates * this->nbins, emptyBin);
+}
+
+void HMM::Estimation::PosteriorCalibration::ConsumePosteriors(size_t firstStep, size_t nsteps, size_t,
+                                                              const double* posteriors)
+{
+    double binScale = static_cast<double> (nbins);
+
+    // section: fused pass, every posterior updates its expected count and its reliability bin
+    for (size_t t = 0; t < nsteps; ++t) {
+        const double* row = posteriors + t * nstates;
+        size_t realState = realStates[firstStep + t];
+        double* expectedRow = expectedCounts.data() + realState * nstates;
+
+        for (size_t i = 0; i < nstates; ++i) {
+            expectedRow[i] += row[i];
+        }
+
+        for (size_t i = 0; i < nstates; ++i) {
+            size_t bin = std::min(static_cast<size_t> (row[i] * binScale), nbins - 1);
+            Bin& stateBin = bins[i * nbins + bin];
+
+            ++stateBin.count;
+            stateBin.sumProb += row[i];
+            stateBin.positives += (i == realState ? 1 : 0);
+        }
+    }
+}
+
+void HMM::Estimation::PosteriorCalibration::Merge(const PosteriorCalibration& other)
+{
+    if (other.nstates != nstates || other.nbins != nbins) {
+        throw std::invalid_argument("Merged calibrations have different number of states or bins");
+    }
+
+    std::transform(expectedCounts.begin(), expectedCounts.end(), other.expectedCounts.begin(),
+                   expectedCounts.begin(), std::plus<double>());
+
+    for (size_t k = 0; k < bins.size(); ++k) {
+        bins[k].count += other.bins[k].count;
+        bins[k].sumProb += other.bins[k].sumProb;
+        bins[k].positives += other.bins[k].positives;
+    }
+}
+
+HMM::Estimation::PosteriorCalibration::Bin
+HMM::Estimation::PosteriorCalibration::PooledBin(size_t bin, size_t firstState, size_t endState) const
+{
+    Bin pooled = {0, 0., 0};
+
+    for (size_t i = firstState; i < std::min(endState, nstates); ++i) {
+        const Bin& stateBin = bins[i * nbins + bin];
+
+        pooled.count += stateBin.count;
+        pooled.sumProb += stateBin.sumProb;
+        pooled.positives += stateBin.positives;
+    }
+
+    return pooled;
+}
+
+double HMM::Estimation::PosteriorCalibration::ExpectedCalibrationError(size_t firstState, size_t endState) const
+{
+    size_t totalCount = 0;
+    double weightedGap = 0;
+
+    for (size_t b = 0; b < nbins; ++b) {
+        Bin pooled = PooledBin(b, firstState, endState);
+
+        totalCount += pooled.count;
+        weightedGap += std::fabs(pooled.sumProb - static_cast<double> (pooled.positives));
+    }
+
+    return (totalCount != 0 ? weightedGap / static_cast<double> (totalCount) : 0.);
+}
+
+HMM::Estimation::ThresholdCurves::ThresholdCurves(size_t nstates, size_t nbuckets, const ColumnView& realStates)
+    : nstates(nstates)
+    , nbuckets(std::max<size_t> (nbuckets, 1))
+    , realStates(realStates)
+    , positives(nstates * this->nbuckets, 0)
+    , negatives(nstates * this->nbuckets, 0)
+{
+}
+
+void HMM::Estimation::ThresholdCurves::ConsumePosteriors(size_t firstStep, size_t nsteps, size_t,
+                                                         const double* posteriors)
+{
+    double bucketScale = static_cast<double> (nbuckets);
+
+    // real state is counted as negative together with the others and moved to positives afterwards
+    for (size_t t = 0; t < nsteps; ++t) {
+        const double* row = posteriors + t * nstates;
+
+        for (size_t i = 0; i < nstates; ++i) {
+            ++negatives[i * nbuckets + std::min(static_cast<size_t> (row[i] * bucketScale), nbuckets - 1)];
+        }
+
+        size_t realState = realStates[firstStep + t];
+        size_t realBucket = realState * nbuckets +
+                            std::min(static_cast<size_t> (row[realState] * bucketScale), nbuckets - 1);
+
+        --negatives[realBucket];
+        ++positives[realBucket];
+    }
+}
+
+void HMM::Estimation::ThresholdCurves::Merge(const ThresholdCurves& other)
+{
+    if (other.nstates != nstates || other.nbuckets != nbuckets) {
+        throw std::invalid_argument("Merged curves have different number of states or buckets");
+    }
+
+    std::transform(positives.begin(), positives.end(), other.positives.begin(), positives.begin(),
+                   std::plus<size_t>());
+    std::transform(negatives.begin(), negatives.end(), other.negatives.begin(), negatives.begin(),
+                   std::plus<size_t>());
+}
+
+vector<HMM::Estimation::ThresholdCurves::StateCurves> HMM::Estimation::ThresholdCurves::Curves(size_t nthreads) const
+{
+    vector<StateCurves> curves(nstates);
+
+    if (nthreads == 0) {
+        nthreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    nthreads = std::max<size_t> (std::min(nthreads, nstates), 1);
+
+    // section: cumulative counts from the highest bucket down, states interleaved between the threads
+    auto buildCurves = [&](size_t thread)
+    {
+        for (size_t state = thread; state < nstates; state += nthreads) {
+            const size_t* statePositives = positives.data() + state * nbuckets;
+            const size_t* stateNegatives = negatives.data() + state * nbuckets;
+            double totalPositives = static_cast<double> (
+                std::accumulate(statePositives, statePositives + nbuckets, static_cast<size_t> (0)));
+            double totalNegatives = static_cast<double> (
+                std::accumulate(stateNegatives, stateNegatives + nbuckets, static_cast<size_t> (0)));
+
+            StateCurves& stateCurves = curves[state];
+            stateCurves.rocAuc = 0;
+            stateCurves.prAuc = 0;
+
+            size_t truePositives = 0;
+            size_t falsePositives = 0;
+            double prevRate = 0;
+            double prevRecall = 0;
+
+            for (size_t b = nbuckets; b-- > 0;) {
+                if (statePositives[b] == 0 && stateNegatives[b] == 0) {
+                    continue;
+                }
+
+                truePositives += statePositives[b];
+                falsePositives += stateNegatives[b];
+
+                CurvePoint point;
+                point.threshold = static_cast<double> (b) / static_cast<double> (nbuckets);
+                point.falsePositiveRate = (totalNegatives != 0 ? falsePositives / totalNegatives : 0.);
+                point.recall = (totalPositives != 0 ? truePositives / totalPositives : 0.);
+                point.precision = static_cast<double> (truePositives) /
+                                  static_cast<double> (truePositives + falsePositives);
+
+                stateCurves.rocAuc += (point.falsePositiveRate - prevRate) * (point.recall + prevRecall) / 2.;
+                stateCurves.prAuc += (point.recall - prevRecall) * point.precision;
+                stateCurves.points.push_back(point);
+
+                prevRate = point.falsePositiveRate;
+                prevRecall = point.recall;
+            }
+
+            if (totalPositives == 0 || totalNegatives == 0) {
+                stateCurves.rocAuc = 0;
+            }
+        }
+    };
+
+    vector<std::thread> threads;
+
+    for (size_t thread = 1; thread < nthreads; ++thread) {
+        threads.push_back(std::thread(buildCurves, thread));
+    }
+
+    buildCurves(0);
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    return curves;
+}
+
+vector<HMM::Data::PredictionEstimation>
+HMM::Estimation::GetStatePredictionEstimations(const vector<vector<size_t> >& confusionMatrix)
+{
+    vector<PredictionEstimation> estimations;
+    GetStatePredictionEstimations(confusionMatrix, estimations);
+
+    return estimations;
+}
+
+void HMM::Estimation::GetStatePredictionEstimations(const vector<vector<size_t> >& confusionMatrix,
+                                                    vector<PredictionEstimation>& estimations)
+{
+    EstimationBuffers buffers;
+    GetStatePredictionEstimations(confusionMatrix, estimations, buffers);
+}
+
+void HMM::Estimation::GetStatePredictionEstimations(const vector<vector<size_t> >& confusionMatrix,
+                                                    vector<PredictionEstimation>& estimations,
+                                                    EstimationBuffers& buffers)
+{
+    AggregateEstimation aggregate;
+    GetPredictionEstimations(confusionMatrix, 1., estimations, aggregate, buffers);
+}
+
+void HMM::Estimation::GetPredictionEstimations(const vector<vector<size_t> >& confusionMatrix, double beta,
+                                               vector<PredictionEstimation>& estimations,
+                                               AggregateEstimation& aggregate, EstimationBuffers& buffers)
+{
+    size_t nstates = confusionMatrix.size();
+
+    estimations.resize(nstates);
+
+    // section: single row-major pass, row and column sums are the numbers of predictions and real occurrences
+    vector<size_t>& rowSum = buffers.rowSum;
+    vector<size_t>& colSum = buffers.colSum;
+    rowSum.assign(nstates, 0);
+    colSum.assign(nstates, 0);
+    size_t totalObservations = 0;
+    size_t totalCorrect = 0;
+
+    for (size_t i = 0; i < nstates; ++i) {
+        const size_t* row = confusionMatrix[i].data();
+        size_t* col = colSum.data();
+        size_t sum = 0;
+
+        for (size_t j = 0; j < nstates; ++j) {
+            sum += row[j];
+            col[j] += row[j];
+        }
+
+        rowSum[i] = sum;
+        totalObservations += sum;
+        totalCorrect += row[i];
+    }
+
+    // section: calculate prediction estimations for each state
+    double betaSquare = beta * beta;
+    double total = static_cast<double> (totalObservations);
+    double sumF1 = 0;
+    double weightedSumF1 = 0;
+    double sumRowCol = 0;
+    double sumRowSquare = 0;
+    double sumColSquare = 0;
+    size_t npresentStates = 0;
+
+    for (size_t state = 0; state < nstates; ++state) {
+        size_t truePositives = confusionMatrix[state][state];
+        PredictionEstimation& estimation = estimations[state];
+
+        estimation.truePositives = truePositives;
+        estimation.falsePositives = rowSum[state] - truePositives;
+
+        // neither predicted to be current state nor its real state is the current one
+        estimation.trueNegatives = totalObservations - rowSum[state] - colSum[state] + truePositives;
+        estimation.falseNegatives = colSum[state] - truePositives;
+
+        double tp = static_cast<double> (truePositives);
+        double predicted = static_cast<double> (rowSum[state]);
+        double real = static_cast<double> (colSum[state]);
+
+        estimation.precision = (rowSum[state] != 0 ? tp / predicted : 0.);
+        estimation.recall = (colSum[state] != 0 ? tp / real : 0.);
+
+        // harmonic means written through the counts are zero instead of undefined if nothing is true positive
+        estimation.fMeasure = (truePositives != 0 ? 2. * tp / (predicted + real) : 0.);
+        estimation.fBeta = (truePositives != 0 ? (1. + betaSquare) * tp / (predicted + betaSquare * real) : 0.);
+
+        if (rowSum[state] != 0 || colSum[state] != 0) {
+            ++npresentStates;
+            sumF1 += estimation.fMeasure;
+        }
+
+        weightedSumF1 += estimation.fMeasure * real;
+        sumRowCol += predicted * real;
+        sumRowSquare += predicted * predicted;
+        sumColSquare += real * real;
+    }
+
+    // section: aggregate estimations
+    double correct = static_cast<double> (totalCorrect);
+
+    aggregate.observations = totalObservations;
+    aggregate.accuracy = (totalObservations != 0 ? correct / total : 0.);
+    aggregate.microF1 = aggregate.accuracy;
+    aggregate.macroF1 = (npresentStates != 0 ? sumF1 / static_cast<double> (npresentStates) : 0.);
+    aggregate.weightedF1 = (totalObservations != 0 ? weightedSumF1 / total : 0.);
+
+    double chanceAgreement = (totalObservations != 0 ? sumRowCol / (total * total) : 1.);
+    aggregate.kappa = (chanceAgreement < 1. ? (aggregate.accuracy - chanceAgreement) / (1. - chanceAgreement) : 0.);
+
+    double mccDenominator = std::sqrt((total * total - sumRowSquare) * (total * total - sumColSquare));
+    aggregate.mcc = (mccDenominator > 0. ? (correct * total - sumRowCol) / mccDenominator : 0.);
+}
+
+HMM::Estimation::BlockBootstrap::BlockBootstrap(size_t nstates, size_t blockSteps)
+    : nstates(nstates)
+    , blockSteps(blockSteps)
+{
+}
+
+void HMM::Estimation::BlockBootstrap::AddSequence(const ColumnView& realStates, const vector<size_t>& predictedStates)
+{
+    size_t matrixSize = nstates * nstates;
+    size_t* counts = 0;
+
+    for (size_t t = 0; t < predictedStates.size(); ++t) {
+        if (t == 0 || (blockSteps != 0 && t % blockSteps == 0)) {
+            blockCounts.resize(blockCounts.size() + matrixSize, 0);
+            counts = blockCounts.data() + blockCounts.size() - matrixSize;
+        }
+
+        ++counts[predictedStates[t] * nstates + realStates[t]];
+    }
+}
+
+void HMM::Estimation::BlockBootstrap::Merge(const BlockBootstrap& other)
+{
+    if (other.nstates != nstates) {
+        throw std::invalid_argument("Merged bootstraps have different number of states");
+    }
+
+    blockCounts.insert(blockCounts.end(), other.blockCounts.begin(), other.blockCounts.end());
+}
+
+HMM::Estimation::BootstrapEstimation
+HMM::Estimation::BlockBootstrap::Estimate(size_t nreplicates, double confidence, size_t nthreads, uint64_t seed) const
+{
+    size_t nblocks = BlockCount();
+
+    if (nblocks == 0 || nreplicates == 0) {
+        throw std::invalid_argument("Bootstrap needs at least one block and one replicate");
+    }
+
+    if (nthreads == 0) {
+        nthreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    nthreads = std::min(nthreads, nreplicates);
+
+    // per-state precision, recall and f-measure followed by the aggregate scores of every replicate
+    size_t nscores = 3 * nstates + 6;
+    vector<double> scores(nreplicates * nscores);
+
+    // section: replicates, interleaved between the threads
+    auto runReplicates = [&](size_t thread)
+    {
+        std::mt19937_64 engine;
+        std::uniform_int_distribution<size_t> drawBlock(0, nblocks - 1);
+        vector<vector<size_t> > confusionMatrix;
+        vector<PredictionEstimation> estimations;
+        AggregateEstimation aggregate;
+        EstimationBuffers buffers;
+
+        for (size_t r = thread; r < nreplicates; r += nthreads) {
+            std::seed_seq seeds{static_cast<uint32_t> (seed), static_cast<uint32_t> (seed >> 32),
+                                static_cast<uint32_t> (r), static_cast<uint32_t> (static_cast<uint64_t> (r) >> 32)};
+            engine.seed(seeds);
+            ResetMatrix(confusionMatrix, nstates, nstates);
+
+            for (size_t b = 0; b < nblocks; ++b) {
+                const size_t* counts = blockCounts.data() + drawBlock(engine) * nstates * nstates;
+
+                for (size_t i = 0; i < nstates; ++i) {
+                    size_t* row = confusionMatrix[i].data();
+
+                    for (size_t j = 0; j < nstates; ++j) {
+                        row[j] += counts[i * nstates + j];
+                    }
+                }
+            }
+
+            GetPredictionEstimations(confusionMatrix, 1., estimations, aggregate, buffers);
+
+            double* replicate = scores.data() + r * nscores;
+
+            for (size_t i = 0; i < nstates; ++i) {
+                replicate[i] = estimations[i].precision;
+                replicate[nstates + i] = estimations[i].recall;
+                replicate[2 * nstates + i] = estimations[i].fMeasure;
+            }
+
+            double* aggregateScores = replicate + 3 * nstates;
+            aggregateScores[0] = aggregate.accuracy;
+            aggregateScores[1] = aggregate.macroF1;
+            aggregateScores[2] = aggregate.microF1;
+            aggregateScores[3] = aggregate.weightedF1;
+            aggregateScores[4] = aggregate.kappa;
+            aggregateScores[5] = aggregate.mcc;
+        }
+    };
+
+    vector<std::thread> threads;
+
+    for (size_t thread = 1; thread < nthreads; ++thread) {
+        threads.push_back(std::thread(runReplicates, thread));
+    }
+
+    runReplicates(0);
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    // section: percentile intervals of every score
+    double tail = (1. - confidence) / 2.;
+    double lastReplicate = static_cast<double> (nreplicates - 1);
+    size_t lowerRank = static_cast<size_t> (std::floor(tail * lastReplicate));
+    size_t upperRank = static_cast<size_t> (std::ceil((1. - tail) * lastReplicate));
+    vector<ConfidenceInterval> intervals(nscores);
+    vector<double> values(nreplicates);
+
+    for (size_t k = 0; k < nscores; ++k) {
+        for (size_t r = 0; r < nreplicates; ++r) {
+            values[r] = scores[r * nscores + k];
         }
 
+        std::sort(values.begin(), values.end());
+        intervals[k].lower = values[lowerRank];
+        intervals[k].upper = values[std::min(upperRank, nreplicates - 1)];
     }
 
-    return std::move(estimations);
+    BootstrapEstimation estimation;
+    estimation.precision.assign(intervals.begin(), intervals.begin() + nstates);
+    estimation.recall.assign(intervals.begin() + nstates, intervals.begin() + 2 * nstates);
+    estimation.fMeasure.assign(intervals.begin() + 2 * nstates, intervals.begin() + 3 * nstates);
+    estimation.accuracy = intervals[3 * nstates];
+    estimation.macroF1 = intervals[3 * nstates + 1];
+    estimation.microF1 = intervals[3 * nstates + 2];
+    estimation.weightedF1 = intervals[3 * nstates + 3];
+    estimation.kappa = intervals[3 * nstates + 4];
+    estimation.mcc = intervals[3 * nstates + 5];
+
+    return estimation;
 }
 //<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<< end of Estimation namespace definitions <<<<<<<<<<<<<<<<<<<<
@@ -3,9 +3,15 @@
 
 #include <map>
 #include <tuple>
+#include <string>
+#include <cstdint>
+#include <cstring>
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <unordered_map>
+
+#include "hmm_memory.h"
 
 
 /**
@@ -16,6 +22,69 @@ namespace HMM
 {
     namespace Data
     {
+        using Memory::AlignedVector;
+
+        /// marker of the absent state index
+        const size_t UNDEFINED_STATE = static_cast<size_t> (-1);
+
+        /**
+         * \brief Sparse state-symbol emission table stored as per-symbol columns
+         *
+         * \details
+         * Only non-zero probabilities are kept, so memory grows with the number of
+         * non-zero emissions and not with nstates * alphabetSize.
+         * Column of the symbol j occupies the range [columnStart[j], columnStart[j + 1])
+         * of columnState and columnProb arrays, states inside a column are sorted.
+         * Column lookup for an observed symbol is O(1), lookup of a single
+         * (state, symbol) element is a binary search inside the column.
+         */
+        struct SparseEmissionTable
+        {
+            /// single non-zero table element used to build the table
+            struct Emission
+            {
+                size_t state;
+                size_t symbol;
+                double prob;
+            };
+
+            /**
+             * \brief Builds table from the list of emissions
+             *
+             * \note
+             * Zero probabilities are dropped, for repeated (state, symbol) pairs the last one wins.
+             */
+            void Assign(size_t nstates, size_t nsymbols, const std::vector<Emission>& emissions);
+
+            /// probability to emit symbol from state, zero for absent elements
+            double Prob(size_t state, size_t symbol) const;
+
+            /// number of states with non-zero emission of the symbol
+            size_t ColumnSize(size_t symbol) const
+            {
+                return columnStart[symbol + 1] - columnStart[symbol];
+            }
+
+            /// sorted states with non-zero emission of the symbol
+            const size_t* ColumnStates(size_t symbol) const
+            {
+                return columnState.data() + columnStart[symbol];
+            }
+
+            /// emission probabilities matching ColumnStates()
+            const double* ColumnProbs(size_t symbol) const
+            {
+                return columnProb.data() + columnStart[symbol];
+            }
+
+            size_t nstates;
+            size_t nsymbols;
+
+            std::vector<size_t> columnStart;
+            std::vector<size_t> columnState;
+            std::vector<double> columnProb;
+        };
+
         /**
          * \brief Represents hidden markov model description
          */
@@ -32,8 +101,14 @@ namespace HMM
              */
             void ReadModel(std::istream& modelSource);
 
-            /// number of different emission symbols (first such from a..z range in ascii)
-            size_t alphabetSize; 
+            /// upper bound for the number of different emission symbols
+            size_t alphabetSize;
+
+            /// dictionary encoding of symbol tokens, indices are given in order of first appearance
+            std::unordered_map<std::string, size_t> symbolNameToIndex;
+
+            /// inverse conversion
+            std::vector<std::string> symbolIndexToName;
 
             /// conversion of state name string to state index
             std::map<std::string, size_t> stateNameToIndex;
@@ -45,8 +120,242 @@ namespace HMM
             /// very first state is the begin state, the last is the end state
             std::vector<std::vector<double> > transitionProb;
 
-            /// element[i][j] here is the probability to emit symbol j from state i
-            std::vector<std::vector<double> > stateSymbolProb;
+            /// element (i, j) here is the probability to emit symbol j from state i
+            SparseEmissionTable stateSymbolProb;
+        };
+
+        /**
+         * \brief Reason of the model state removal from the compiled tables
+         */
+        enum class PruneReason
+        {
+            None,                   ///< state is live
+            NoEmissions,            ///< state emits nothing (begin and end states among them)
+            UnreachableFromBegin,   ///< no transition path from the begin state
+            CannotReachEnd          ///< no transition path into the end state
+        };
+
+        /**
+         * \brief Model prepared for the algorithms, all derived tables are calculated once
+         *
+         * \details
+         * Compile() builds it from Model, afterwards it is read-only and may be shared
+         * by any number of concurrent algorithm calls.
+         * Compilation finds live states by graph traversal: a live state emits some symbol,
+         * is reachable from the begin state and can reach the end state (both through emitting states).
+         * Other states can not be occupied at any step of a complete state sequence, so they
+         * are pruned and the recurrences run over the live subgraph only. Models without any
+         * transition into the end state are treated as open-ended and the last condition is skipped.
+         * Symbols emitted by no live state are pruned too.
+         * Compiled state i is the model state compiledToOriginal[i], results of the algorithms
+         * are reported in model state indices, stateStatus keeps the reasons of pruning
+         * for reporting in model state names.
+         * Square tables are nstates x nstates row-major arrays over the live states.
+         */
+        struct CompiledModel
+        {
+            void Compile(const Model& model);
+
+            /// number of live states
+            size_t nstates;
+
+            /// number of states of the source model
+            size_t nmodelStates;
+
+            std::vector<size_t> compiledToOriginal;
+
+            /// inverse conversion, UNDEFINED_STATE for pruned states
+            std::vector<size_t> originalToCompiled;
+
+            /// element[i] is the reason of the i-th model state pruning
+            std::vector<PruneReason> stateStatus;
+
+            /// true if the model has no transitions into the end state
+            bool isOpenEnded;
+
+            /// number of symbols emitted by live states
+            size_t nsymbols;
+
+            /// alphabet size of the source model
+            size_t nmodelSymbols;
+
+            /// model symbol index to compiled one, pruned symbols map to the empty column nsymbols
+            std::vector<size_t> symbolToCompiled;
+
+            std::vector<size_t> compiledToOriginalSymbol;
+
+            /// element[j] is the probability of transition from the begin state to j
+            AlignedVector<double> initialProb;
+            AlignedVector<double> logInitialProb;
+
+            /// element[i * nstates + j] is the probability of transition from state i to j
+            AlignedVector<double> transitionProb;
+
+            /// element[j * nstates + i] is the probability of transition from state i to j
+            AlignedVector<double> transitionProbTransposed;
+            AlignedVector<double> logTransitionProbTransposed;
+
+            /// non-zero transitions into state j are in the range [predecessorStart[j], predecessorStart[j + 1])
+            std::vector<size_t> predecessorStart;
+            std::vector<size_t> predecessorState;
+            std::vector<double> predecessorProb;
+            std::vector<double> logPredecessorProb;
+
+            /// emissions of the live states over compiled symbols, logColumnProb matches stateSymbolProb.columnProb
+            SparseEmissionTable stateSymbolProb;
+            std::vector<double> logColumnProb;
+
+            /**
+             * per-symbol transfer matrices over the emitting states: row k (k is the index inside
+             * stateSymbolProb column arrays of the symbol s and state j) holds
+             * transition probability from i to j multiplied by emission of s from j for every i.
+             * Memory grows with the number of non-zero emissions, tables are left empty
+             * if they would exceed MAX_TRANSFER_BYTES.
+             */
+            AlignedVector<double> transferProb;
+            AlignedVector<double> logTransferProb;
+
+            /// pruned model states in increasing order
+            std::vector<size_t> eliminatedStates;
+
+            /// transitions of pruned state d into live states are in [eliminatedStart[d], eliminatedStart[d + 1])
+            std::vector<size_t> eliminatedStart;
+            std::vector<size_t> eliminatedSuccessor;
+            std::vector<double> eliminatedProb;
+
+            /// true if transitions are sparse enough for the predecessor list kernels to win
+            bool preferSparse;
+        };
+
+        /// upper limit of the memory used by each of CompiledModel transfer tables
+        const size_t MAX_TRANSFER_BYTES = 64UL << 20;
+
+        /// max fraction of non-zero transitions for which CompiledModel prefers sparse kernels
+        const double SPARSE_TRANSITIONS_DENSITY = 0.25;
+
+        /**
+         * \brief Read-only view over a column of unsigned integers
+         *
+         * \details
+         * Elements are width bytes wide (1, 2, 4 or 8) and placed stride bytes apart,
+         * so the view describes both packed columns and a field of an array of structures.
+         */
+        struct ColumnView
+        {
+            ColumnView()
+                : first(0)
+                , count(0)
+                , stride(0)
+                , width(0)
+            {
+            }
+
+            ColumnView(const void* first, size_t count, size_t stride, size_t width)
+                : first(static_cast<const unsigned char*> (first))
+                , count(count)
+                , stride(stride)
+                , width(width)
+            {
+            }
+
+            size_t operator[](size_t i) const
+            {
+                const unsigned char* element = first + i * stride;
+
+                if (width == 1) {
+                    return *element;
+                } else if (width == 2) {
+                    uint16_t value;
+                    std::memcpy(&value, element, sizeof(value));
+                    return value;
+                } else if (width == 4) {
+                    uint32_t value;
+                    std::memcpy(&value, element, sizeof(value));
+                    return value;
+                }
+
+                uint64_t value;
+                std::memcpy(&value, element, sizeof(value));
+                return value;
+            }
+
+            size_t size() const
+            {
+                return count;
+            }
+
+            const unsigned char* first;
+            size_t count;
+            size_t stride;
+            size_t width;
+        };
+
+        /**
+         * \brief Growable contiguous column of unsigned integers of the narrowest sufficient width
+         *
+         * \details
+         * Width is chosen from the expected max value and is widened (with repacking)
+         * when a larger value is appended.
+         */
+        struct PackedColumn
+        {
+            /// empty column of 1-byte elements
+            PackedColumn()
+                : width(1)
+            {
+            }
+
+            /// clears column and chooses element width to fit values up to maxValue
+            void Reset(size_t maxValue);
+
+            void PushBack(size_t value);
+
+            ColumnView View() const
+            {
+                return ColumnView(bytes.data(), bytes.size() / width, width, width);
+            }
+
+            size_t width;
+            std::vector<unsigned char> bytes;
+        };
+
+        /// absolute tolerance of transition probability sums compared by the state lumping
+        const double LUMPING_TOLERANCE = 1e-12;
+
+        /**
+         * \brief Model with exactly equivalent states merged (lumped)
+         *
+         * \details
+         * Minimise() finds the coarsest partition of the model states in which states of
+         * each block have identical emission distributions and identical total transition
+         * probabilities into every block (partition refinement as in DFA minimisation).
+         * Such blocks form a smaller Model which yields the same likelihood for any observations,
+         * so inference cost shrinks quadratically with the number of merged states.
+         * Begin and end states always stay single. Lumped state names join member names by '+'.
+         */
+        struct LumpedModel
+        {
+            void Minimise(const Model& source);
+
+            /**
+             * \brief Expands the state sequence of the lumped model into the source model states
+             *
+             * \details
+             * Runs the Viterbi algorithm over the source model restricted at each step
+             * to the members of the given lumped state, so the result is the most probable
+             * source state sequence consistent with the lumped one.
+             * If no such sequence emits the observations, the result consists of begin states.
+             */
+            std::vector<size_t> ExpandStateSequence(const Model& source, const ColumnView& symbols,
+                                                    const std::vector<size_t>& lumpedStates) const;
+
+            Model model;
+
+            /// source model state index to lumped state index
+            std::vector<size_t> originalToLumped;
+
+            /// source model states of each lumped state in increasing order
+            std::vector<std::vector<size_t> > lumpedToOriginal;
         };
 
         /**
@@ -65,10 +374,60 @@ namespace HMM
              */
             void ReadExperimentData(const Model& model, std::istream& dataSource);
 
+            /// view over the emitted symbols of the triples
+            ColumnView SymbolColumn() const;
+
+            /// view over the real states of the triples
+            ColumnView StateColumn() const;
+
             /// Data triples as (time, state, symbol_emitted)
             std::vector<std::tuple<size_t, size_t, size_t> > timeStateSymbol;
         };
 
+        /**
+         * \brief Represents experiment data for some particular model as separate packed columns
+         *
+         * \details
+         * Columnar alternative to ExperimentData: states and symbols are stored in
+         * contiguous arrays of the narrowest type fitting the model state count and
+         * alphabet size (usually one or two bytes per step instead of 24 bytes per triple),
+         * so the algorithms read observations sequentially.
+         */
+        struct ColumnarExperimentData
+        {
+            /**
+             * \brief Read experiment data from the stream
+             *
+             * \details
+             * The same as ExperimentData::ReadExperimentData().
+             */
+            void ReadExperimentData(const Model& model, std::istream& dataSource);
+
+            size_t Size() const
+            {
+                return symbols.View().size();
+            }
+
+            ColumnView TimeColumn() const
+            {
+                return times.View();
+            }
+
+            ColumnView StateColumn() const
+            {
+                return states.View();
+            }
+
+            ColumnView SymbolColumn() const
+            {
+                return symbols.View();
+            }
+
+            PackedColumn times;
+            PackedColumn states;
+            PackedColumn symbols;
+        };
+
         /**
          * \brief State prediction estimation results for different hidden markov models algorithms
          */
@@ -79,25 +438,152 @@ namespace HMM
             size_t trueNegatives;
             size_t falseNegatives;
             double fMeasure;
+
+            /// zero if the state is never predicted (precision) or never real (recall)
+            double precision;
+            double recall;
+
+            /// F-beta score of the requested beta, equal to fMeasure for beta 1
+            double fBeta;
+        };
+
+        /**
+         * \brief Prediction estimation results over all states
+         *
+         * \details
+         * Macro F1 averages f-measures of the states which are real or predicted at least once,
+         * weighted F1 weights them by the number of real occurrences. Micro F1 of single state
+         * predictions equals accuracy. Kappa and MCC are the multiclass Cohen's kappa and
+         * Matthews correlation coefficient, zero if undefined (a single state everywhere).
+         */
+        struct AggregateEstimation
+        {
+            size_t observations;
+            double accuracy;
+            double macroF1;
+            double microF1;
+            double weightedF1;
+            double kappa;
+            double mcc;
         };
     };
 
     namespace Algorithms
     {
         using Data::Model;
+        using Data::CompiledModel;
         using Data::ExperimentData;
+        using Data::ColumnView;
+
+        /**
+         * \note
+         * Every algorithm is available for Model and for CompiledModel.
+         * Model overloads compile the model on each call, so callers running
+         * many sequences against the same model should compile it once and use
+         * CompiledModel overloads.
+         * Workspace overloads additionally reuse all temporary tables and results
+         * across calls, so decoding of many similar sequences stops allocating memory.
+         */
+
+        /**
+         * \brief Recurrence kernels of the algorithms
+         *
+         * \details
+         * Dense kernels run over all live states (transfer rows or transposed transitions),
+         * sparse ones over predecessor lists. Auto follows CompiledModel::preferSparse.
+         */
+        enum class Kernel { Auto, Dense, Sparse };
+
+        /**
+         * \brief Reusable storage and execution settings of the algorithms
+         *
+         * \details
+         * Temporary tables (trellis rows, backpointers and etc.) are taken from the arena,
+         * which is reset at the start of every call. Results of the last call are kept
+         * in the result members, their capacity grows as needed and is never released.
+         * If memoryBudget is not zero, every call first estimates its peak memory
+         * (see EstimatePeakBytes()) and switches to a lower-memory variant with the same
+         * results if the estimate exceeds the budget. If there is no such variant within
+         * the budget, std::length_error is thrown before any large allocation.
+         * \note
+         * Workspace may be used by a single thread at a time.
+         */
+        struct Workspace
+        {
+            Workspace()
+                : memoryBudget(0),
+                  kernel(Kernel::Auto),
+                  parallelPasses(false)
+            {
+            }
+
+            Memory::Arena arena;
+
+            /// limit of the estimated peak memory of a call in bytes, zero if unlimited
+            size_t memoryBudget;
+
+            Kernel kernel;
+
+            /// if set, forward and backward passes of CalcForwardBackwardProbabiliies run on two threads
+            bool parallelPasses;
+
+            /// result of the last FindMostProbableStateSequence call
+            std::vector<size_t> mostProbableSeq;
+
+            /// result of the last CalcForwardBackwardProbabiliies call
+            std::vector<std::vector<std::pair<double, double> > > forwardBackwardProb;
+
+            /// rows of forwardBackwardProb kept for reuse after shorter sequences
+            std::vector<std::vector<std::pair<double, double> > > spareRows;
+        };
 
         /**
          * \brief Finds most probable sequence of hidden states
          *
          * \details
-         * Implementation is based on the Viterbi algorithm.
+         * Implementation is based on the Viterbi algorithm in the log space.
+         * If observations can not be emitted by any state sequence the result
+         * consists of begin states (index 0), one per observation.
          *
          * \returns vector with predicted hidden state indices
          */
         std::vector<size_t>
         FindMostProbableStateSequence(const Model& model, const ExperimentData& data);
 
+        /// the same for the column of emitted symbols
+        std::vector<size_t>
+        FindMostProbableStateSequence(const Model& model, const ColumnView& symbols);
+
+        /// the same for the compiled model
+        std::vector<size_t>
+        FindMostProbableStateSequence(const CompiledModel& model, const ColumnView& symbols);
+
+        /// the same with reusable storage, result is valid until the next call with the workspace
+        const std::vector<size_t>&
+        FindMostProbableStateSequence(const CompiledModel& model, const ColumnView& symbols,
+                                      Workspace& workspace);
+
+        /// the same writing the result into the caller container, which capacity is reused
+        void FindMostProbableStateSequence(const CompiledModel& model, const ColumnView& symbols,
+                                           Workspace& workspace, std::vector<size_t>& mostProbableSeq);
+
+        /**
+         * \brief Finds most probable sequence of hidden states keeping backpointers of one segment only
+         *
+         * \details
+         * Checkpointed variant of the Viterbi algorithm. The first pass keeps the log
+         * probability rows at the segment boundaries, then backpointers are recomputed
+         * segment by segment in reverse order during the traceback. It takes twice
+         * the time, but memory drops from maxtime x nstates backpointers to about
+         * 2 * sqrt(maxtime) x nstates values with the default segment length.
+         * Results are the same as of FindMostProbableStateSequence.
+         *
+         * \param segmentSteps number of steps in the segment, zero for sqrt(maxtime)
+         */
+        void FindMostProbableStateSequenceCheckpointed(const CompiledModel& model, const ColumnView& symbols,
+                                                       Workspace& workspace, std::vector<size_t>& mostProbableSeq,
+                                                       size_t segmentSteps = 0);
+
         /**
          * \brief Calculates alpha-beta value pairs for each time moment
          *
@@ -115,13 +601,190 @@ namespace HMM
          */
         std::vector<std::vector<std::pair<double, double> > >
         CalcForwardBackwardProbabiliies(const Model& model, const ExperimentData& data);
+
+        /// the same for the column of emitted symbols
+        std::vector<std::vector<std::pair<double, double> > >
+        CalcForwardBackwardProbabiliies(const Model& model, const ColumnView& symbols);
+
+        /// the same for the compiled model
+        std::vector<std::vector<std::pair<double, double> > >
+        CalcForwardBackwardProbabiliies(const CompiledModel& model, const ColumnView& symbols);
+
+        /// the same with reusable storage, result is valid until the next call with the workspace
+        const std::vector<std::vector<std::pair<double, double> > >&
+        CalcForwardBackwardProbabiliies(const CompiledModel& model, const ColumnView& symbols,
+                                        Workspace& workspace);
+
+        /**
+         * \brief Receiver of posterior state probabilities produced block by block
+         */
+        struct PosteriorSink
+        {
+            virtual ~PosteriorSink() {}
+
+            /**
+             * \brief Consumes posterior rows for steps [firstStep, firstStep + nsteps)
+             *
+             * \details
+             * posteriors is row-major nsteps x nstates block, element [t][i] is the
+             * probability of the i-th hidden state at step firstStep + t given all observations.
+             * \note
+             * Blocks cover disjoint step ranges and may arrive in any order.
+             * The block memory is reused by the producer after the call returns.
+             */
+            virtual void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                           const double* posteriors) = 0;
+        };
+
+        /**
+         * \brief Sink passing every block to several sinks in the order they were added
+         *
+         * \note
+         * Lets one posterior pass feed all consumers instead of repeating the algorithm.
+         */
+        class PosteriorFanout : public PosteriorSink
+        {
+        public:
+            void Add(PosteriorSink& sink);
+
+            void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                   const double* posteriors) override;
+
+        private:
+            std::vector<PosteriorSink*> sinks;
+        };
+
+        /// default number of steps in blocks passed to the sinks
+        const size_t DEFAULT_BLOCK_STEPS = 1024;
+
+        /**
+         * \brief Streams posterior state probabilities to the sink
+         *
+         * \details
+         * Implementation is based on the Forward-Backward algorithm with per-step
+         * normalisation, so long sequences do not underflow.
+         * Backward table is kept in memory, forward probabilities are calculated
+         * on the fly and posteriors are passed to the sink in blocks of blockSteps
+         * rows in increasing step order, the full posterior matrix is never materialised.
+         */
+        void StreamPosteriorProbabilities(const Model& model, const ExperimentData& data,
+                                          PosteriorSink& sink,
+                                          size_t blockSteps = DEFAULT_BLOCK_STEPS);
+
+        /// the same for the column of emitted symbols
+        void StreamPosteriorProbabilities(const Model& model, const ColumnView& symbols,
+                                          PosteriorSink& sink,
+                                          size_t blockSteps = DEFAULT_BLOCK_STEPS);
+
+        /// the same for the compiled model
+        void StreamPosteriorProbabilities(const CompiledModel& model, const ColumnView& symbols,
+                                          PosteriorSink& sink,
+                                          size_t blockSteps = DEFAULT_BLOCK_STEPS);
+
+        /**
+         * \brief The same with reusable storage
+         *
+         * \returns natural logarithm of the probability of the observed symbols
+         *          summed from the forward normalisers, as CalcLogLikelihood does without another pass
+         */
+        double StreamPosteriorProbabilities(const CompiledModel& model, const ColumnView& symbols,
+                                            PosteriorSink& sink, Workspace& workspace,
+                                            size_t blockSteps = DEFAULT_BLOCK_STEPS);
+
+        /// default number of steps kept in memory by the out-of-core algorithms
+        const size_t DEFAULT_WINDOW_STEPS = 4096;
+
+        /**
+         * \brief Algorithm variants with different memory demands
+         *
+         * \details
+         * Viterbi - FindMostProbableStateSequence, maxtime x nstates backpointers.
+         * CheckpointedViterbi - FindMostProbableStateSequenceCheckpointed.
+         * ForwardBackward - CalcForwardBackwardProbabiliies, maxtime x model states result.
+         * StreamingPosteriors - StreamPosteriorProbabilities, maxtime x nstates backward table.
+         * OutOfCorePosteriors - StreamPosteriorProbabilitiesOutOfCore, one window in memory.
+         */
+        enum class Variant
+        {
+            Viterbi,
+            CheckpointedViterbi,
+            ForwardBackward,
+            StreamingPosteriors,
+            OutOfCorePosteriors
+        };
+
+        /**
+         * \brief Estimates peak memory allocated by the algorithm variant for a sequence
+         *
+         * \details
+         * The estimate covers temporary tables and results of a call with a fresh
+         * Workspace, the compiled model itself is not included.
+         * blockSteps is the number of posterior block (window) steps of the streaming
+         * (out-of-core) variants, zero for their default.
+         *
+         * \returns upper bound of the allocated bytes
+         */
+        size_t EstimatePeakBytes(const CompiledModel& model, size_t nsteps, Variant variant,
+                                 size_t blockSteps = 0);
+
+        /**
+         * \brief Streams posterior state probabilities to the sink keeping only a window of steps in memory
+         *
+         * \details
+         * Out-of-core variant of StreamPosteriorProbabilities for sequences which
+         * maxtime x nstates tables do not fit into the main memory.
+         * Normalised forward table is written window by window into a memory-mapped
+         * scratch file created in scratchDirectory, then the windows are mapped back
+         * in reverse order during the backward pass.
+         * Posteriors are passed to the sink in blocks of windowSteps rows
+         * in decreasing step order.
+         * \note
+         * Scratch file errors are reported by std::system_error exceptions.
+         */
+        void StreamPosteriorProbabilitiesOutOfCore(const Model& model, const ExperimentData& data,
+                                                   PosteriorSink& sink,
+                                                   const std::string& scratchDirectory,
+                                                   size_t windowSteps = DEFAULT_WINDOW_STEPS);
+
+        /// the same for the column of emitted symbols
+        void StreamPosteriorProbabilitiesOutOfCore(const Model& model, const ColumnView& symbols,
+                                                   PosteriorSink& sink,
+                                                   const std::string& scratchDirectory,
+                                                   size_t windowSteps = DEFAULT_WINDOW_STEPS);
+
+        /// the same for the compiled model
+        void StreamPosteriorProbabilitiesOutOfCore(const CompiledModel& model, const ColumnView& symbols,
+                                                   PosteriorSink& sink,
+                                                   const std::string& scratchDirectory,
+                                                   size_t windowSteps = DEFAULT_WINDOW_STEPS);
+
+        /// the same with reusable storage
+        void StreamPosteriorProbabilitiesOutOfCore(const CompiledModel& model, const ColumnView& symbols,
+                                                   PosteriorSink& sink, Workspace& workspace,
+                                                   const std::string& scratchDirectory,
+                                                   size_t windowSteps = DEFAULT_WINDOW_STEPS);
+
+        /**
+         * \brief Calculates natural logarithm of the probability of the observed symbols
+         *
+         * \details
+         * Forward pass over two normalised rows, the logarithm is the sum of the logarithms
+         * of the row normalisers, so it does not underflow on long sequences.
+         * Transitions into the end state are not included, as in the forward-backward algorithm.
+         *
+         * \returns -infinity if the model can not emit the symbols
+         */
+        double CalcLogLikelihood(const CompiledModel& model, const ColumnView& symbols, Workspace& workspace);
     };
 
     namespace Estimation
     {
         using Data::Model;
+        using Data::CompiledModel;
         using Data::ExperimentData;
+        using Data::ColumnView;
         using Data::PredictionEstimation;
+        using Data::AggregateEstimation;
 
         using std::vector;
         using std::pair;
@@ -132,6 +795,30 @@ namespace HMM
         vector<size_t> GetMostProbableStates(
             const vector<vector<pair<double, double> > >& forwardBackwardProb);
 
+        /// the same writing the result into the caller container, which capacity is reused
+        void GetMostProbableStates(const vector<vector<pair<double, double> > >& forwardBackwardProb,
+                                   vector<size_t>& mostProbableStates);
+
+        /**
+         * \brief Sink collecting the most probable state at each step from posterior blocks
+         *
+         * \details
+         * Counterpart of GetMostProbableStates for the streaming algorithms, which work
+         * with normalised probabilities and so do not underflow on long sequences.
+         * mostProbableStates must have an element for every step before the algorithm runs.
+         */
+        class MostProbableStatesSink : public Algorithms::PosteriorSink
+        {
+        public:
+            explicit MostProbableStatesSink(vector<size_t>& mostProbableStates);
+
+            void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                   const double* posteriors) override;
+
+        private:
+            vector<size_t>& mostProbableStates;
+        };
+
         /**
          * \note
          * Confusion matrix element[i][j] is the number of elements with the
@@ -142,6 +829,279 @@ namespace HMM
         vector<vector<size_t> > CombineConfusionMatrix(const ExperimentData& realData,
                                                        const vector<size_t>& predictedStates, const Model& model);
 
+        /// the same for the column of real states
+        vector<vector<size_t> > CombineConfusionMatrix(const ColumnView& realStates,
+                                                       const vector<size_t>& predictedStates, const Model& model);
+
+        /// the same for the compiled model
+        vector<vector<size_t> > CombineConfusionMatrix(const ColumnView& realStates,
+                                                       const vector<size_t>& predictedStates,
+                                                       const CompiledModel& model);
+
+        /**
+         * \note
+         * The following overloads write the result into the caller containers,
+         * their capacity is reused, so repeated calls with the same model do not allocate.
+         */
+
+        /// the same for the column of real states writing into the caller matrix
+        void CombineConfusionMatrix(const ColumnView& realStates, const vector<size_t>& predictedStates,
+                                    const Model& model, vector<vector<size_t> >& confusionMatrix);
+
+        /// the same for the compiled model writing into the caller matrix
+        void CombineConfusionMatrix(const ColumnView& realStates, const vector<size_t>& predictedStates,
+                                    const CompiledModel& model, vector<vector<size_t> >& confusionMatrix);
+
+        /**
+         * \brief Confusion matrix accumulated over chunks of predictions
+         *
+         * \details
+         * Chunks may come in any order and from several sequences, accumulators filled
+         * by different threads or processes are summed by Merge (or Write and Read),
+         * so a corpus is evaluated without concatenating its predictions.
+         * Matrix() is the input of GetStatePredictionEstimations.
+         */
+        class ConfusionAccumulator
+        {
+        public:
+            explicit ConfusionAccumulator(size_t nstates = 0);
+
+            /// clears the counts and sets the number of (model) states
+            void Reset(size_t nstates);
+
+            /// counts the chunk predictedStates[0, nsteps) against realStates[firstStep, firstStep + nsteps)
+            void Add(const ColumnView& realStates, size_t firstStep, size_t nsteps, const size_t* predictedStates);
+
+            /// the same for the whole sequence
+            void Add(const ColumnView& realStates, const vector<size_t>& predictedStates);
+
+            /**
+             * \brief Adds the counts of the other accumulator
+             *
+             * \note
+             * Accumulators of different number of states are reported by std::invalid_argument exceptions.
+             */
+            void Merge(const ConfusionAccumulator& other);
+
+            /// writes the number of states and the counts row by row as text
+            void Write(std::ostream& target) const;
+
+            /// reads the counts written by Write and merges them
+            void Read(std::istream& source);
+
+            const vector<vector<size_t> >& Matrix() const
+            {
+                return confusionMatrix;
+            }
+
+        private:
+            vector<vector<size_t> > confusionMatrix;
+        };
+
+        /**
+         * \brief Sink counting the most probable state of every step in the accumulator
+         *
+         * \details
+         * Evaluates streamed posteriors as they are decoded, without the predicted states vector.
+         */
+        class ConfusionSink : public Algorithms::PosteriorSink
+        {
+        public:
+            ConfusionSink(const ColumnView& realStates, ConfusionAccumulator& accumulator);
+
+            void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                   const double* posteriors) override;
+
+        private:
+            ColumnView realStates;
+            ConfusionAccumulator& accumulator;
+            vector<size_t> predictedStates;
+        };
+
+        /**
+         * \brief Run of the same state over the steps [firstStep, endStep)
+         */
+        struct StateSegment
+        {
+            size_t state;
+            size_t firstStep;
+            size_t endStep;
+        };
+
+        /**
+         * \brief Run-length encodes the state sequence into segments in the step order
+         *
+         * \details
+         * Contiguous columns are compared with themselves shifted by one step in chunks by
+         * std::memcmp, which is vectorised by the C library, so steps inside long runs
+         * are skipped without per-element branches.
+         */
+        void ExtractSegments(const ColumnView& states, vector<StateSegment>& segments);
+
+        /// the same for the vector of states
+        void ExtractSegments(const vector<size_t>& states, vector<StateSegment>& segments);
+
+        /**
+         * \brief Matches predicted segments to the real ones and estimates them per state
+         *
+         * \details
+         * A predicted segment matches a real segment of the same state if both of their
+         * boundaries differ by at most tolerance steps, every segment matches at most once.
+         * True positives are matched segments, false positives and false negatives are
+         * unmatched predicted and real ones, true negatives are not defined and left zero.
+         */
+        void GetSegmentEstimations(const vector<StateSegment>& realSegments,
+                                   const vector<StateSegment>& predictedSegments,
+                                   size_t nstates, size_t tolerance,
+                                   vector<PredictionEstimation>& estimations);
+
+        /// default number of posterior probability bins of the calibration histograms
+        const size_t DEFAULT_CALIBRATION_BINS = 10;
+
+        /**
+         * \brief Sink evaluating posteriors without taking the most probable states
+         *
+         * \details
+         * Every posterior block is read once to accumulate both the expected confusion
+         * matrix, which element [i][j] is the sum of posteriors of the state i at the steps
+         * with the real state j, and per-state reliability histograms: the posterior of
+         * every (step, state) pair falls into one of nbins equal probability bins,
+         * which count the pairs, sum their posteriors and count the pairs of the real state.
+         */
+        class PosteriorCalibration : public Algorithms::PosteriorSink
+        {
+        public:
+            /// reliability bin of posterior probabilities [b / nbins, (b + 1) / nbins)
+            struct Bin
+            {
+                size_t count;
+                double sumProb;
+                size_t positives;
+            };
+
+            explicit PosteriorCalibration(size_t nstates = 0, size_t nbins = DEFAULT_CALIBRATION_BINS,
+                                          const ColumnView& realStates = ColumnView());
+
+            void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                   const double* posteriors) override;
+
+            /**
+             * \brief Adds the counts of the other calibration
+             *
+             * \note
+             * Calibrations of different sizes are reported by std::invalid_argument exceptions.
+             */
+            void Merge(const PosteriorCalibration& other);
+
+            /// expected number of steps with the predicted state i when the real state is j
+            double ExpectedCount(size_t predictedState, size_t realState) const
+            {
+                return expectedCounts[realState * nstates + predictedState];
+            }
+
+            size_t BinCount() const
+            {
+                return nbins;
+            }
+
+            /// reliability bin of the state
+            const Bin& StateBin(size_t state, size_t bin) const
+            {
+                return bins[state * nbins + bin];
+            }
+
+            /// reliability bin pooled over the states [firstState, endState), all states by default
+            Bin PooledBin(size_t bin, size_t firstState = 0, size_t endState = Data::UNDEFINED_STATE) const;
+
+            /// mean over the pairs of |mean posterior - frequency of the real state| of their pooled bins
+            double ExpectedCalibrationError(size_t firstState = 0, size_t endState = Data::UNDEFINED_STATE) const;
+
+        private:
+            size_t nstates;
+            size_t nbins;
+            ColumnView realStates;
+
+            /// element[j * nstates + i] is the expected count of predicted i when real is j
+            vector<double> expectedCounts;
+            vector<Bin> bins;
+        };
+
+        /// default number of posterior probability buckets of the threshold curves
+        const size_t DEFAULT_SCORE_BUCKETS = 1 << 12;
+
+        /**
+         * \brief Sink building per-state ROC and precision-recall curves of the posteriors
+         *
+         * \details
+         * Instead of sorting the posteriors of all steps, every posterior is put into one
+         * of nbuckets equal probability buckets counting real and other states, so memory
+         * does not depend on the number of steps and sinks of different threads or sequences
+         * are merged by summing. Thresholds are the lower bucket edges, posteriors inside
+         * a bucket are treated as ties.
+         */
+        class ThresholdCurves : public Algorithms::PosteriorSink
+        {
+        public:
+            /// state is predicted if its posterior is at least the threshold
+            struct CurvePoint
+            {
+                double threshold;
+                double falsePositiveRate;
+                double recall;
+                double precision;
+            };
+
+            struct StateCurves
+            {
+                /// points of the decreasing non-empty bucket thresholds
+                vector<CurvePoint> points;
+
+                /// area under ROC curve by trapezoids, zero if the state is always or never real
+                double rocAuc;
+
+                /// area under precision-recall curve as the average precision, zero if the state is never real
+                double prAuc;
+            };
+
+            explicit ThresholdCurves(size_t nstates = 0, size_t nbuckets = DEFAULT_SCORE_BUCKETS,
+                                     const ColumnView& realStates = ColumnView());
+
+            void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                   const double* posteriors) override;
+
+            /**
+             * \brief Adds the counts of the other curves
+             *
+             * \note
+             * Curves of different sizes are reported by std::invalid_argument exceptions.
+             */
+            void Merge(const ThresholdCurves& other);
+
+            /// curves of all states, states are processed on nthreads threads (zero for hardware threads)
+            vector<StateCurves> Curves(size_t nthreads = 0) const;
+
+        private:
+            size_t nstates;
+            size_t nbuckets;
+            ColumnView realStates;
+
+            /// element[state * nbuckets + bucket] is the number of the bucket posteriors of real and other states
+            vector<size_t> positives;
+            vector<size_t> negatives;
+        };
+
+        /**
+         * \brief Scratch sums of the estimations, reused by repeated calls
+         */
+        struct EstimationBuffers
+        {
+            /// element[i] is the number of predictions of the state i
+            vector<size_t> rowSum;
+
+            /// element[j] is the number of real occurrences of the state j
+            vector<size_t> colSum;
+        };
+
         /**
          * \brief Use confusion matrix to calculate estimations of the prediction results
          *
@@ -149,6 +1109,99 @@ namespace HMM
          */
         vector<PredictionEstimation>
             GetStatePredictionEstimations(const vector<vector<size_t> >& confusionMatrix);
+
+        /// the same writing the result into the caller container
+        void GetStatePredictionEstimations(const vector<vector<size_t> >& confusionMatrix,
+                                           vector<PredictionEstimation>& estimations);
+
+        /// the same reusing the caller scratch sums, no allocations once the containers are large enough
+        void GetStatePredictionEstimations(const vector<vector<size_t> >& confusionMatrix,
+                                           vector<PredictionEstimation>& estimations,
+                                           EstimationBuffers& buffers);
+
+        /**
+         * \brief Calculates per-state estimations with F-beta scores and the aggregate estimation
+         *
+         * \details
+         * The matrix is read once to get its diagonal, row and column sums, all scores
+         * are calculated from those in linear time of the number of states.
+         * The sums are kept in the caller buffers, so repeated calls do not allocate.
+         */
+        void GetPredictionEstimations(const vector<vector<size_t> >& confusionMatrix, double beta,
+                                      vector<PredictionEstimation>& estimations, AggregateEstimation& aggregate,
+                                      EstimationBuffers& buffers);
+
+        /// percentile interval of the bootstrap replicates of a score
+        struct ConfidenceInterval
+        {
+            double lower;
+            double upper;
+        };
+
+        /**
+         * \brief Confidence intervals of the GetPredictionEstimations scores (F1 scores)
+         */
+        struct BootstrapEstimation
+        {
+            vector<ConfidenceInterval> precision;
+            vector<ConfidenceInterval> recall;
+            vector<ConfidenceInterval> fMeasure;
+
+            ConfidenceInterval accuracy;
+            ConfidenceInterval macroF1;
+            ConfidenceInterval microF1;
+            ConfidenceInterval weightedF1;
+            ConfidenceInterval kappa;
+            ConfidenceInterval mcc;
+        };
+
+        /// default number of steps in the resampled blocks
+        const size_t DEFAULT_BOOTSTRAP_BLOCK_STEPS = 1000;
+
+        /**
+         * \brief Block bootstrap of the prediction estimations
+         *
+         * \details
+         * Decoded sequences are cut into blocks of blockSteps steps (a sequence always starts
+         * a new block, zero blockSteps makes every sequence one block) and a confusion matrix
+         * is counted for every block once. Every replicate draws as many blocks with replacement
+         * and sums their matrices, so it costs O(blocks * nstates^2) regardless of the number of steps.
+         */
+        class BlockBootstrap
+        {
+        public:
+            explicit BlockBootstrap(size_t nstates = 0, size_t blockSteps = DEFAULT_BOOTSTRAP_BLOCK_STEPS);
+
+            void AddSequence(const ColumnView& realStates, const vector<size_t>& predictedStates);
+
+            /// appends blocks of the other bootstrap of the same number of states
+            void Merge(const BlockBootstrap& other);
+
+            size_t BlockCount() const
+            {
+                return (nstates == 0 ? 0 : blockCounts.size() / (nstates * nstates));
+            }
+
+            /**
+             * \brief Calculates percentile intervals of all scores over the replicates
+             *
+             * \details
+             * Replicates run on nthreads threads (zero for the number of hardware threads),
+             * each thread has its own random engine seeded for every replicate by (seed, replicate),
+             * so the results do not depend on the number of threads.
+             *
+             * \param confidence e.g. 0.95 for the 2.5 and 97.5 percentiles
+             */
+            BootstrapEstimation Estimate(size_t nreplicates, double confidence,
+                                         size_t nthreads = 0, uint64_t seed = 0) const;
+
+        private:
+            size_t nstates;
+            size_t blockSteps;
+
+            /// nstates x nstates confusion matrix of every block, one after another
+            vector<size_t> blockCounts;
+        };
     };
 };
 
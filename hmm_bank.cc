@@ -0,0 +1,241 @@
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#include "hmm_bank.h"
+
+using std::vector;
+
+using HMM::Data::CompiledModel;
+using HMM::Data::ColumnView;
+using HMM::Bank::ModelBank;
+using HMM::Bank::ModelScore;
+using HMM::Bank::BANK_BATCH_MODELS;
+
+ModelBank::ModelBank(size_t nsymbols)
+    : nsymbols(nsymbols)
+{
+}
+
+size_t ModelBank::Add(const CompiledModel& model, const vector<size_t>& symbolMap)
+{
+    size_t nstates = model.nstates;
+
+    if (! symbolMap.empty() && symbolMap.size() != nsymbols) {
+        throw std::invalid_argument("Symbol map does not cover the bank symbols");
+    }
+
+    if (symbolMap.empty() && model.nmodelSymbols > nsymbols) {
+        throw std::invalid_argument("Model has more symbols than the bank");
+    }
+
+    // section: first batch of the same size with a free slot or a new one
+    size_t b = 0;
+
+    while (b < batches.size() && (batches[b].nstates != nstates || batches[b].nmodels == BANK_BATCH_MODELS)) {
+        ++b;
+    }
+
+    if (b == batches.size()) {
+        Batch batch;
+        batch.nstates = nstates;
+        batch.nmodels = 0;
+        batch.initialProb.assign(nstates * BANK_BATCH_MODELS, 0.);
+        batch.transitionProb.assign(nstates * nstates * BANK_BATCH_MODELS, 0.);
+        batch.emissionProb.assign(nsymbols * nstates * BANK_BATCH_MODELS, 0.);
+        batch.maxLogEmission.assign(nsymbols * BANK_BATCH_MODELS, -std::numeric_limits<double>::infinity());
+        batch.logRowGrowth.assign(BANK_BATCH_MODELS, 0.);
+        batches.push_back(batch);
+    }
+
+    Batch& batch = batches[b];
+    size_t k = batch.nmodels++;
+
+    // section: model tables into the slot k
+    for (size_t j = 0; j < nstates; ++j) {
+        batch.initialProb[j * BANK_BATCH_MODELS + k] = model.initialProb[j];
+
+        for (size_t i = 0; i < nstates; ++i) {
+            batch.transitionProb[(i * nstates + j) * BANK_BATCH_MODELS + k] = model.transitionProb[i * nstates + j];
+        }
+    }
+
+    // section: largest row sum, the likelihood of a step grows at most by it besides the emission
+    double maxRowSum = std::accumulate(model.initialProb.begin(), model.initialProb.end(), 0.);
+
+    for (size_t i = 0; i < nstates; ++i) {
+        const double* row = model.transitionProb.data() + i * nstates;
+        maxRowSum = std::max(maxRowSum, std::accumulate(row, row + nstates, 0.));
+    }
+
+    batch.logRowGrowth[k] = std::log(std::max(maxRowSum, 1.));
+
+    for (size_t s = 0; s < nsymbols; ++s) {
+        size_t modelSymbol = (symbolMap.empty() ? s : symbolMap[s]);
+
+        if (modelSymbol == Data::UNDEFINED_STATE || modelSymbol >= model.nmodelSymbols) {
+            continue;
+        }
+
+        size_t symbol = model.symbolToCompiled[modelSymbol];
+        double maxEmission = 0;
+
+        for (size_t j = 0; j < nstates; ++j) {
+            double emission = model.stateSymbolProb.Prob(j, symbol);
+
+            batch.emissionProb[(s * nstates + j) * BANK_BATCH_MODELS + k] = emission;
+            maxEmission = std::max(maxEmission, emission);
+        }
+
+        batch.maxLogEmission[s * BANK_BATCH_MODELS + k] = std::log(maxEmission);
+    }
+
+    locations.push_back(std::make_pair(b, k));
+
+    return locations.size() - 1;
+}
+
+size_t ModelBank::Classify(const ColumnView& symbols, vector<ModelScore>& scores, double margin) const
+{
+    const double LOG_ZERO = -std::numeric_limits<double>::infinity();
+    const size_t K = BANK_BATCH_MODELS;
+    size_t maxtime = symbols.size();
+
+    double bestLogLikelihood = LOG_ZERO;
+    size_t bestModel = Size();
+
+    vector<vector<ModelScore> > batchScores(batches.size(), vector<ModelScore>(K));
+    vector<vector<bool> > batchEmits(batches.size(), vector<bool>(K, false));
+
+    AlignedVector<double> prevForward;
+    AlignedVector<double> curForward;
+
+    for (size_t b = 0; b < batches.size(); ++b) {
+        const Batch& batch = batches[b];
+        size_t nstates = batch.nstates;
+
+        prevForward.assign(nstates * K, 0.);
+        curForward.assign(nstates * K, 0.);
+
+        // section: likelihood bounds of the whole sequence, reduced step by step
+        double logLikelihood[K];
+        double remainingBound[K];
+        bool isActive[K];
+
+        for (size_t k = 0; k < K; ++k) {
+            logLikelihood[k] = 0;
+            remainingBound[k] = 0;
+            isActive[k] = (k < batch.nmodels);
+        }
+
+        for (size_t t = 0; t < maxtime; ++t) {
+            for (size_t k = 0; k < K; ++k) {
+                remainingBound[k] += batch.maxLogEmission[symbols[t] * K + k] + batch.logRowGrowth[k];
+            }
+        }
+
+        // section: forward pass of all models of the batch together
+        size_t nactive = batch.nmodels;
+
+        for (size_t t = 0; t < maxtime && nactive != 0; ++t) {
+            const double* emission = batch.emissionProb.data() + symbols[t] * nstates * K;
+            double* cur = curForward.data();
+            const double* prev = prevForward.data();
+
+            if (t == 0) {
+                for (size_t c = 0; c < nstates * K; ++c) {
+                    cur[c] = batch.initialProb[c] * emission[c];
+                }
+            } else {
+                std::fill(cur, cur + nstates * K, 0.);
+
+                for (size_t i = 0; i < nstates; ++i) {
+                    const double* prevRow = prev + i * K;
+                    const double* transitionRow = batch.transitionProb.data() + i * nstates * K;
+
+                    for (size_t j = 0; j < nstates; ++j) {
+                        for (size_t k = 0; k < K; ++k) {
+                            cur[j * K + k] += prevRow[k] * transitionRow[j * K + k];
+                        }
+                    }
+                }
+
+                for (size_t c = 0; c < nstates * K; ++c) {
+                    cur[c] *= emission[c];
+                }
+            }
+
+            // section: scale every model row to the unit sum and check the bounds
+            double scale[K];
+            std::fill(scale, scale + K, 0.);
+
+            for (size_t j = 0; j < nstates; ++j) {
+                for (size_t k = 0; k < K; ++k) {
+                    scale[k] += cur[j * K + k];
+                }
+            }
+
+            for (size_t k = 0; k < K; ++k) {
+                if (! isActive[k]) {
+                    continue;
+                }
+
+                if (scale[k] == 0) {
+                    logLikelihood[k] = LOG_ZERO;
+                    isActive[k] = false;
+                    --nactive;
+                    continue;
+                }
+
+                logLikelihood[k] += std::log(scale[k]);
+                remainingBound[k] -= batch.maxLogEmission[symbols[t] * K + k] + batch.logRowGrowth[k];
+
+                if (logLikelihood[k] + remainingBound[k] < bestLogLikelihood - margin) {
+                    batchScores[b][k].terminated = true;
+                    isActive[k] = false;
+                    --nactive;
+                }
+            }
+
+            for (size_t j = 0; j < nstates; ++j) {
+                for (size_t k = 0; k < K; ++k) {
+                    cur[j * K + k] = (scale[k] != 0 ? cur[j * K + k] / scale[k] : 0.);
+                }
+            }
+
+            std::swap(prevForward, curForward);
+        }
+
+        // section: finished models may become the best one
+        for (size_t k = 0; k < batch.nmodels; ++k) {
+            ModelScore& score = batchScores[b][k];
+
+            if (score.terminated) {
+                score.logLikelihood = logLikelihood[k] + remainingBound[k];
+            } else {
+                score.logLikelihood = logLikelihood[k];
+            }
+
+            batchEmits[b][k] = (! score.terminated && logLikelihood[k] != LOG_ZERO);
+        }
+
+        for (size_t m = 0; m < locations.size(); ++m) {
+            if (locations[m].first == b && batchEmits[b][locations[m].second] &&
+                batchScores[b][locations[m].second].logLikelihood > bestLogLikelihood) {
+                bestLogLikelihood = batchScores[b][locations[m].second].logLikelihood;
+                bestModel = m;
+            }
+        }
+    }
+
+    // section: scores in the bank order
+    scores.resize(Size());
+
+    for (size_t m = 0; m < Size(); ++m) {
+        scores[m] = batchScores[locations[m].first][locations[m].second];
+    }
+
+    return bestModel;
+}
@@ -0,0 +1,113 @@
+#ifndef HMM_BANK_H
+#define HMM_BANK_H
+
+#include <vector>
+#include <cstddef>
+
+#include "hmm.h"
+
+
+/**
+ * \note
+ * Bank of models classifying sequences by the model of the maximum likelihood.
+ */
+namespace HMM
+{
+    namespace Bank
+    {
+        using Data::CompiledModel;
+        using Data::ColumnView;
+        using Memory::AlignedVector;
+
+        /// number of models of equal size processed together, slots of the model tables are interleaved
+        const size_t BANK_BATCH_MODELS = 8;
+
+        /**
+         * \brief Likelihood of the sequence by one model of the bank
+         */
+        struct ModelScore
+        {
+            /// log-likelihood, or its upper bound if the model was terminated early
+            double logLikelihood;
+
+            /// true if the model could not catch up with the best one and was not scored to the end
+            bool terminated;
+        };
+
+        /**
+         * \brief Models scoring sequences by the scaled forward algorithm
+         *
+         * \details
+         * Models of equal number of live states are grouped into batches of BANK_BATCH_MODELS.
+         * Tables of a batch store the same element of all its models contiguously
+         * (element [i][j][k] is the transition i -> j of the k-th model), so every forward step
+         * of the batch is a dense matrix product with the innermost loop over the models.
+         * Bank symbols are common for all models, each model maps them into its own symbols.
+         */
+        class ModelBank
+        {
+        public:
+            explicit ModelBank(size_t nsymbols);
+
+            /**
+             * \brief Adds the model and returns its index in the bank
+             *
+             * \param symbolMap element[s] is the model symbol index of the bank symbol s,
+             * Data::UNDEFINED_STATE if the model can not emit it, empty if indices are the same
+             */
+            size_t Add(const CompiledModel& model, const std::vector<size_t>& symbolMap = std::vector<size_t>());
+
+            size_t Size() const
+            {
+                return locations.size();
+            }
+
+            /**
+             * \brief Scores the sequence by all models and returns the index of the most likely one
+             *
+             * \details
+             * Every step multiplies the likelihood at most by the largest emission probability
+             * of its symbol, so a model is terminated as soon as its likelihood so far times
+             * such bounds of the remaining steps falls below the best finished likelihood
+             * by more than margin (natural logarithm). Zero margin keeps the result exact.
+             * \note
+             * The emission bound holds if initial and transition rows sum to at most one.
+             * Models with larger sums (e.g. not normalised files or rounding) multiply
+             * the bound of every step by their largest sum, so the result stays exact.
+             *
+             * \returns Size() if no model can emit the sequence
+             */
+            size_t Classify(const ColumnView& symbols, std::vector<ModelScore>& scores, double margin = 0) const;
+
+        private:
+            struct Batch
+            {
+                size_t nstates;
+                size_t nmodels;
+
+                /// element[j * BANK_BATCH_MODELS + k]
+                AlignedVector<double> initialProb;
+
+                /// element[(i * nstates + j) * BANK_BATCH_MODELS + k]
+                AlignedVector<double> transitionProb;
+
+                /// element[(s * nstates + j) * BANK_BATCH_MODELS + k] for the bank symbol s
+                AlignedVector<double> emissionProb;
+
+                /// element[s * BANK_BATCH_MODELS + k] is the log of the largest emission of the bank symbol s
+                AlignedVector<double> maxLogEmission;
+
+                /// element[k] is the log of the largest initial or transition row sum above one, otherwise zero
+                AlignedVector<double> logRowGrowth;
+            };
+
+            size_t nsymbols;
+            std::vector<Batch> batches;
+
+            /// (batch, slot) of every model
+            std::vector<std::pair<size_t, size_t> > locations;
+        };
+    };
+};
+
+#endif // HMM_BANK_H
@@ -0,0 +1,269 @@
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "hmm_memory.h"
+
+using std::string;
+
+using HMM::Memory::Arena;
+using HMM::Memory::PageBacking;
+using HMM::Memory::ScratchFile;
+
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ */
+namespace
+{
+    void ThrowSystemError(const string& what)
+    {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    /**
+     * \brief Aux. function to map anonymous memory on huge pages
+     *
+     * \returns start of the mapping or 0 if the backing is unavailable
+     */
+    void* MapHugePages(size_t size, PageBacking backing)
+    {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+        if (backing == PageBacking::ExplicitHugePages) {
+#ifdef MAP_HUGETLB
+            flags |= MAP_HUGETLB;
+#else
+            return 0;
+#endif
+        }
+
+        void* start = mmap(0, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+        if (start == MAP_FAILED) {
+            return 0;
+        }
+
+        if (backing == PageBacking::TransparentHugePages) {
+#ifdef MADV_HUGEPAGE
+            if (madvise(start, size, MADV_HUGEPAGE) != 0) {
+                munmap(start, size);
+                return 0;
+            }
+#else
+            munmap(start, size);
+            return 0;
+#endif
+        }
+
+        return start;
+    }
+};
+
+Arena::Arena()
+    : preferredBacking(PageBacking::Heap)
+    , used(0)
+{
+}
+
+Arena::~Arena()
+{
+    ReleaseBlocks();
+}
+
+void Arena::SetPageBacking(PageBacking backing)
+{
+    preferredBacking = backing;
+}
+
+void Arena::AddBlock(size_t minBytes)
+{
+    size_t size = std::max(minBytes, MIN_ARENA_BLOCK_BYTES);
+
+    if (! blocks.empty()) {
+        size = std::max(size, 2 * blocks.back().size);
+    }
+
+    Block block = {0, size, PageBacking::Heap};
+
+    // section: try huge pages for large blocks, explicit ones fall back to transparent ones
+    if (preferredBacking != PageBacking::Heap && size >= HUGE_PAGE_BYTES) {
+        size_t hugeSize = (size + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+
+        if (preferredBacking == PageBacking::ExplicitHugePages) {
+            block.start = static_cast<char*> (MapHugePages(hugeSize, PageBacking::ExplicitHugePages));
+            block.backing = PageBacking::ExplicitHugePages;
+        }
+
+        if (block.start == 0) {
+            block.start = static_cast<char*> (MapHugePages(hugeSize, PageBacking::TransparentHugePages));
+            block.backing = PageBacking::TransparentHugePages;
+        }
+
+        if (block.start != 0) {
+            block.size = hugeSize;
+        }
+    }
+
+    // section: heap fallback
+    if (block.start == 0) {
+        void* memory = 0;
+
+        if (posix_memalign(&memory, TABLE_ALIGNMENT, size) != 0) {
+            throw std::bad_alloc();
+        }
+
+        block.start = static_cast<char*> (memory);
+        block.backing = PageBacking::Heap;
+    }
+
+    blocks.push_back(block);
+    used = 0;
+}
+
+void Arena::ReleaseBlocks()
+{
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (blocks[i].backing == PageBacking::Heap) {
+            free(blocks[i].start);
+        } else {
+            munmap(blocks[i].start, blocks[i].size);
+        }
+    }
+
+    blocks.clear();
+}
+
+void* Arena::Allocate(size_t bytes, size_t alignment)
+{
+    // blocks start at TABLE_ALIGNMENT boundaries, so aligned offsets give aligned addresses
+    size_t offset = (used + alignment - 1) / alignment * alignment;
+
+    if (blocks.empty() || offset + bytes > blocks.back().size) {
+        AddBlock(bytes);
+        offset = 0;
+    }
+
+    used = offset + bytes;
+
+    return blocks.back().start + offset;
+}
+
+void Arena::Reset()
+{
+    used = 0;
+
+    if (blocks.size() < 2) {
+        return;
+    }
+
+    size_t totalSize = Capacity();
+
+    ReleaseBlocks();
+    AddBlock(totalSize);
+}
+
+size_t Arena::Capacity() const
+{
+    size_t totalSize = 0;
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        totalSize += blocks[i].size;
+    }
+
+    return totalSize;
+}
+
+size_t Arena::Capacity(PageBacking backing) const
+{
+    size_t totalSize = 0;
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        totalSize += (blocks[i].backing == backing ? blocks[i].size : 0);
+    }
+
+    return totalSize;
+}
+
+ScratchFile::ScratchFile(const string& directory, size_t size)
+    : descriptor(-1)
+    , size(size)
+    , windowStart(0)
+    , windowLength(0)
+{
+    // an empty name would place the file into the root directory
+    if (directory.empty()) {
+        throw std::invalid_argument("Scratch directory is not given");
+    }
+
+    string pattern = directory + "/hmm-scratch-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+
+    descriptor = mkstemp(path.data());
+
+    if (descriptor < 0) {
+        ThrowSystemError("Failed to create scratch file in '" + directory + "'");
+    }
+
+    unlink(path.data());
+
+    if (ftruncate(descriptor, static_cast<off_t> (size)) != 0) {
+        int error = errno;
+        close(descriptor);
+        errno = error;
+        ThrowSystemError("Failed to resize scratch file");
+    }
+}
+
+ScratchFile::~ScratchFile()
+{
+    UnmapWindow();
+    close(descriptor);
+}
+
+void* ScratchFile::MapWindow(size_t offset, size_t length)
+{
+    UnmapWindow();
+
+    if (offset + length > size) {
+        throw std::out_of_range("Scratch file window is out of the file bounds");
+    }
+
+    // mapping offset must be page aligned
+    size_t pageSize = static_cast<size_t> (sysconf(_SC_PAGESIZE));
+    size_t alignedOffset = offset - offset % pageSize;
+    size_t alignedLength = length + (offset - alignedOffset);
+    void* start = mmap(0, alignedLength, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       descriptor, static_cast<off_t> (alignedOffset));
+
+    if (start == MAP_FAILED) {
+        ThrowSystemError("Failed to map scratch file window");
+    }
+
+    windowStart = start;
+    windowLength = alignedLength;
+
+    return static_cast<char*> (start) + (offset - alignedOffset);
+}
+
+void ScratchFile::UnmapWindow()
+{
+    if (windowStart == 0) {
+        return;
+    }
+
+    // start write back now, so dirty pages can be reclaimed without stalls later
+    msync(windowStart, windowLength, MS_ASYNC);
+    munmap(windowStart, windowLength);
+
+    windowStart = 0;
+    windowLength = 0;
+}
@@ -0,0 +1,210 @@
+#ifndef HMM_MEMORY_H
+#define HMM_MEMORY_H
+
+#include <new>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdlib>
+
+
+/**
+ * \note
+ * Memory management helpers for the algorithms: aligned allocation of
+ * the tables and scratch storage for tables which do not fit into the main memory.
+ */
+namespace HMM
+{
+    namespace Memory
+    {
+        /// alignment of the numeric tables, one cache line which also fits any SIMD register
+        const size_t TABLE_ALIGNMENT = 64;
+
+        /**
+         * \brief Standard allocator returning memory aligned to the given boundary
+         */
+        template <typename T, size_t Alignment = TABLE_ALIGNMENT>
+        struct AlignedAllocator
+        {
+            typedef T value_type;
+
+            template <typename U>
+            struct rebind
+            {
+                typedef AlignedAllocator<U, Alignment> other;
+            };
+
+            AlignedAllocator()
+            {
+            }
+
+            template <typename U>
+            AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+            {
+            }
+
+            T* allocate(size_t n)
+            {
+                void* memory = 0;
+
+                if (posix_memalign(&memory, Alignment, n * sizeof(T)) != 0) {
+                    throw std::bad_alloc();
+                }
+
+                return static_cast<T*> (memory);
+            }
+
+            void deallocate(T* memory, size_t)
+            {
+                free(memory);
+            }
+        };
+
+        template <typename T, typename U, size_t Alignment>
+        bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+        {
+            return true;
+        }
+
+        template <typename T, typename U, size_t Alignment>
+        bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+        {
+            return false;
+        }
+
+        /// vector with TABLE_ALIGNMENT aligned storage
+        template <typename T>
+        using AlignedVector = std::vector<T, AlignedAllocator<T> >;
+
+        /// minimal size of the arena block
+        const size_t MIN_ARENA_BLOCK_BYTES = 64 * 1024;
+
+        /// huge page size assumed for the huge page backed blocks (default on x86-64)
+        const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+        /**
+         * \brief Kind of memory backing the arena blocks
+         *
+         * \details
+         * Heap - regular aligned heap allocation.
+         * TransparentHugePages - anonymous mapping advised to use transparent huge pages
+         * (madvise MADV_HUGEPAGE), the kernel may still back it by regular pages.
+         * ExplicitHugePages - mapping from the preallocated hugetlbfs pool (MAP_HUGETLB).
+         */
+        enum class PageBacking { Heap, TransparentHugePages, ExplicitHugePages };
+
+        /**
+         * \brief Bump allocator for temporary tables of the algorithms
+         *
+         * \details
+         * Memory is handed out from large blocks by moving a pointer and is released
+         * all at once by Reset(). If the current block is exhausted a larger one is added,
+         * Reset() then joins all blocks into a single one of the total size, so repeated
+         * calls with similar demands stop allocating after the first one.
+         * Blocks of at least HUGE_PAGE_BYTES may be requested on huge pages to reduce
+         * TLB misses over large tables, see SetPageBacking(). If the requested backing
+         * is unavailable, explicit huge pages fall back to transparent ones and those
+         * fall back to the heap.
+         * \note
+         * Only trivially destructible objects may be placed into the arena,
+         * their destructors are never called.
+         */
+        class Arena
+        {
+        public:
+            Arena();
+            ~Arena();
+
+            /// sets preferred backing of the blocks allocated from now on
+            void SetPageBacking(PageBacking backing);
+
+            /**
+             * \brief Returns uninitialised memory of the given size valid until the next Reset()
+             *
+             * \note
+             * alignment must be a power of two not greater than TABLE_ALIGNMENT.
+             */
+            void* Allocate(size_t bytes, size_t alignment = TABLE_ALIGNMENT);
+
+            /// returns array of n copies of value valid until the next Reset()
+            template <typename T>
+            T* AllocateArray(size_t n, const T& value)
+            {
+                T* first = static_cast<T*> (Allocate(n * sizeof(T)));
+                std::uninitialized_fill(first, first + n, value);
+
+                return first;
+            }
+
+            /// releases all allocations at once
+            void Reset();
+
+            /// total size of the owned blocks in bytes
+            size_t Capacity() const;
+
+            /// total size of the owned blocks with the given actual backing in bytes
+            size_t Capacity(PageBacking backing) const;
+
+        private:
+            Arena(const Arena&);
+            Arena& operator=(const Arena&);
+
+            void AddBlock(size_t minBytes);
+            void ReleaseBlocks();
+
+            struct Block
+            {
+                char* start;
+                size_t size;
+                PageBacking backing;
+            };
+
+            std::vector<Block> blocks;
+            PageBacking preferredBacking;
+
+            /// bytes used in the last block
+            size_t used;
+        };
+
+        /**
+         * \brief Temporary file of fixed size accessed through a memory-mapped window
+         *
+         * \details
+         * The file is created inside the given directory and unlinked immediately,
+         * so it disappears with the process. Only one window is mapped at a time,
+         * previously mapped window is flushed and unmapped, so the resident part
+         * of the file is bounded by the window length.
+         * \note
+         * Errors are reported by std::system_error exceptions,
+         * an empty directory name by std::invalid_argument.
+         */
+        class ScratchFile
+        {
+        public:
+            ScratchFile(const std::string& directory, size_t size);
+            ~ScratchFile();
+
+            /**
+             * \brief Maps bytes [offset, offset + length) of the file
+             *
+             * \returns pointer to the byte at offset, valid until the next MapWindow() call
+             */
+            void* MapWindow(size_t offset, size_t length);
+
+            /// flushes and unmaps current window, if any
+            void UnmapWindow();
+
+        private:
+            ScratchFile(const ScratchFile&);
+            ScratchFile& operator=(const ScratchFile&);
+
+            int descriptor;
+            size_t size;
+            void* windowStart;
+            size_t windowLength;
+        };
+    };
+};
+
+#endif // HMM_MEMORY_H
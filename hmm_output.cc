@@ -0,0 +1,208 @@
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "hmm_output.h"
+
+using std::vector;
+using std::string;
+
+using HMM::Output::Format;
+using HMM::Output::ArrayFileWriter;
+using HMM::Output::PosteriorWriter;
+using HMM::Output::PathWriter;
+
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ */
+namespace
+{
+    /// number of elements converted at once when conversion is required
+    const size_t CONVERSION_CHUNK_ELEMENTS = 4096;
+
+    bool IsLittleEndianHost()
+    {
+        const uint16_t probe = 1;
+        unsigned char firstByte;
+
+        std::memcpy(&firstByte, &probe, 1);
+
+        return firstByte == 1;
+    }
+
+    /**
+     * \brief Aux. function to write unsigned value as little-endian of the given size
+     */
+    void WriteLittleEndian(std::ostream& target, uint64_t value, size_t size)
+    {
+        for (size_t i = 0; i < size; ++i) {
+            target.put(static_cast<char> ((value >> (8 * i)) & 0xFF));
+        }
+    }
+
+    /**
+     * \brief Aux. function to find the narrowest unsigned integer size fitting the max value
+     */
+    size_t NarrowestUnsignedSize(size_t maxValue)
+    {
+        if (maxValue <= 0xFFUL) {
+            return 1;
+        } else if (maxValue <= 0xFFFFUL) {
+            return 2;
+        } else if (maxValue <= 0xFFFFFFFFUL) {
+            return 4;
+        }
+
+        return 8;
+    }
+
+    /**
+     * \brief Aux. function to describe element type for the npy header, e.g. '<f8'
+     */
+    string NpyTypeDescription(char typeCode, size_t elementSize)
+    {
+        std::ostringstream description;
+
+        description << (elementSize == 1 ? '|' : '<') << typeCode << elementSize;
+
+        return description.str();
+    }
+
+    void WriteRawHeader(std::ostream& target, char typeCode,
+                        size_t elementSize, const vector<size_t>& shape)
+    {
+        target.write("HMMARRAY", 8);
+        target.put(typeCode);
+        target.put(static_cast<char> (elementSize));
+        WriteLittleEndian(target, shape.size(), 2);
+
+        for (size_t i = 0; i < shape.size(); ++i) {
+            WriteLittleEndian(target, shape[i], 8);
+        }
+    }
+
+    void WriteNpyHeader(std::ostream& target, char typeCode,
+                        size_t elementSize, const vector<size_t>& shape)
+    {
+        std::ostringstream header;
+
+        header << "{'descr': '" << NpyTypeDescription(typeCode, elementSize)
+               << "', 'fortran_order': False, 'shape': (";
+
+        for (size_t i = 0; i < shape.size(); ++i) {
+            header << shape[i] << (shape.size() == 1 || i + 1 < shape.size() ? "," : "");
+            header << (i + 1 < shape.size() ? " " : "");
+        }
+
+        header << "), }";
+
+        // magic (6) + version (2) + header length (2), data must start 64-byte aligned
+        const size_t prefixSize = 10;
+        string headerText = header.str();
+        size_t paddedSize = ((prefixSize + headerText.size() + 1 + 63) / 64) * 64 - prefixSize;
+
+        headerText.append(paddedSize - headerText.size() - 1, ' ');
+        headerText.push_back('\n');
+
+        target.write("\x93NUMPY", 6);
+        target.put(1);
+        target.put(0);
+        WriteLittleEndian(target, headerText.size(), 2);
+        target.write(headerText.data(), headerText.size());
+    }
+};
+
+ArrayFileWriter::ArrayFileWriter(const string& path, Format format, char typeCode,
+                                 size_t elementSize, const vector<size_t>& shape)
+    : elementSize(elementSize)
+    , nextElement(0)
+{
+    target.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+    target.open(path.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+
+    if (format == Format::Raw) {
+        WriteRawHeader(target, typeCode, elementSize, shape);
+    } else {
+        WriteNpyHeader(target, typeCode, elementSize, shape);
+    }
+
+    dataOffset = target.tellp();
+}
+
+void ArrayFileWriter::WriteElements(size_t firstElement, size_t nelements, const void* elements)
+{
+    if (firstElement != nextElement) {
+        target.seekp(dataOffset + static_cast<std::streamoff> (firstElement * elementSize));
+    }
+
+    const char* bytes = static_cast<const char*> (elements);
+
+    if (IsLittleEndianHost() || elementSize == 1) {
+        target.write(bytes, nelements * elementSize);
+    } else {
+        // section: swap bytes chunk by chunk for big-endian hosts
+        vector<char> chunk(CONVERSION_CHUNK_ELEMENTS * elementSize);
+
+        for (size_t first = 0; first < nelements; first += CONVERSION_CHUNK_ELEMENTS) {
+            size_t count = std::min(CONVERSION_CHUNK_ELEMENTS, nelements - first);
+
+            for (size_t i = 0; i < count; ++i) {
+                std::reverse_copy(bytes + (first + i) * elementSize,
+                                  bytes + (first + i + 1) * elementSize,
+                                  chunk.data() + i * elementSize);
+            }
+
+            target.write(chunk.data(), count * elementSize);
+        }
+    }
+
+    nextElement = firstElement + nelements;
+}
+
+PosteriorWriter::PosteriorWriter(const string& path, Format format, size_t nsteps, size_t nstates)
+    : writer(path, format, 'f', sizeof(double), vector<size_t> {nsteps, nstates})
+{
+}
+
+void PosteriorWriter::ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                        const double* posteriors)
+{
+    writer.WriteElements(firstStep * nstates, nsteps * nstates, posteriors);
+}
+
+PathWriter::PathWriter(const string& path, Format format, size_t nsteps, size_t nstates)
+    : elementSize(NarrowestUnsignedSize(nstates - 1))
+    , writer(path, format, 'u', elementSize, vector<size_t> {nsteps})
+{
+}
+
+void PathWriter::WritePath(size_t firstStep, size_t nsteps, const size_t* states)
+{
+    if (elementSize == sizeof(size_t)) {
+        writer.WriteElements(firstStep, nsteps, states);
+        return;
+    }
+
+    // section: narrow states chunk by chunk
+    vector<unsigned char> chunk(CONVERSION_CHUNK_ELEMENTS * elementSize);
+
+    for (size_t first = 0; first < nsteps; first += CONVERSION_CHUNK_ELEMENTS) {
+        size_t count = std::min(CONVERSION_CHUNK_ELEMENTS, nsteps - first);
+
+        for (size_t i = 0; i < count; ++i) {
+            uint8_t  value8  = static_cast<uint8_t>  (states[first + i]);
+            uint16_t value16 = static_cast<uint16_t> (states[first + i]);
+            uint32_t value32 = static_cast<uint32_t> (states[first + i]);
+            const void* value = (elementSize == 1 ? static_cast<const void*> (&value8) :
+                                 elementSize == 2 ? static_cast<const void*> (&value16) :
+                                                    static_cast<const void*> (&value32));
+
+            std::memcpy(chunk.data() + i * elementSize, value, elementSize);
+        }
+
+        writer.WriteElements(firstStep + first, count, chunk.data());
+    }
+}
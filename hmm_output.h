@@ -0,0 +1,99 @@
+#ifndef HMM_OUTPUT_H
+#define HMM_OUTPUT_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "hmm.h"
+
+
+/**
+ * \note
+ * Binary writers for decoded paths and posterior probabilities.
+ * File layouts are described in the output.spec file.
+ */
+namespace HMM
+{
+    namespace Output
+    {
+        /**
+         * \brief Binary file layout
+         *
+         * Raw is the little-endian array with a small fixed header,
+         * Npy is the numpy .npy format (version 1.0).
+         */
+        enum class Format
+        {
+            Raw,
+            Npy
+        };
+
+        /**
+         * \brief Writes fixed-shape little-endian array to the file element block by element block
+         *
+         * \details
+         * Header is written on construction, so the array shape must be known up front.
+         * Blocks may be written in any order, the file is seeked only when the block
+         * does not continue the previous one, so in-order writing works for non-seekable targets too.
+         * \note
+         * Errors are reported by std::ios_base::failure exceptions of the underlying stream.
+         */
+        class ArrayFileWriter
+        {
+        public:
+            /**
+             * \param typeCode 'f' for floating point or 'u' for unsigned integer elements
+             */
+            ArrayFileWriter(const std::string& path, Format format, char typeCode,
+                            size_t elementSize, const std::vector<size_t>& shape);
+
+            /**
+             * \brief Writes elements [firstElement, firstElement + nelements) of the flattened array
+             *
+             * \note
+             * Elements are in the host byte order, they are converted to little-endian if necessary.
+             */
+            void WriteElements(size_t firstElement, size_t nelements, const void* elements);
+
+        private:
+            std::ofstream target;
+            std::streamoff dataOffset;
+            size_t elementSize;
+            size_t nextElement;
+        };
+
+        /**
+         * \brief Writes posterior matrix nsteps x nstates of doubles as it is streamed from the decoder
+         */
+        class PosteriorWriter : public Algorithms::PosteriorSink
+        {
+        public:
+            PosteriorWriter(const std::string& path, Format format, size_t nsteps, size_t nstates);
+
+            void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates,
+                                   const double* posteriors) override;
+
+        private:
+            ArrayFileWriter writer;
+        };
+
+        /**
+         * \brief Writes state path of nsteps elements using the narrowest unsigned type fitting nstates
+         */
+        class PathWriter
+        {
+        public:
+            PathWriter(const std::string& path, Format format, size_t nsteps, size_t nstates);
+
+            /// writes states of steps [firstStep, firstStep + nsteps)
+            void WritePath(size_t firstStep, size_t nsteps, const size_t* states);
+
+        private:
+            size_t elementSize;
+            ArrayFileWriter writer;
+        };
+    };
+};
+
+#endif // HMM_OUTPUT_H
@@ -0,0 +1,268 @@
+#ifndef HMM_PIPELINE_H
+#define HMM_PIPELINE_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include <stdexcept>
+
+
+/**
+ * \note
+ * Staged processing helpers: bounded lock-free queues and the pipeline
+ * which overlaps input parsing, decoding and results output.
+ */
+namespace HMM
+{
+    namespace Pipeline
+    {
+        /// assumed cache line size, used to keep producer and consumer positions apart
+        const size_t CACHE_LINE_SIZE = 64;
+
+        /// a blocked queue side retries this number of times before it sleeps on the condition variable
+        const size_t QUEUE_SPIN_LIMIT = 64;
+
+        /**
+         * \brief Bounded lock-free single-producer single-consumer queue
+         *
+         * \details
+         * Ring buffer with monotonically growing head and tail positions.
+         * Exactly one thread may push and exactly one (other) thread may pop.
+         * Push blocks while the queue is full, which gives back-pressure to the producer,
+         * Pop blocks while the queue is empty. A blocked side retries QUEUE_SPIN_LIMIT times
+         * and then sleeps on a condition variable until the other side changes the queue,
+         * so a long stage does not keep its neighbours busy. The mutex is taken only
+         * by sleeping threads and by the side waking them.
+         */
+        template <typename T>
+        class SpscQueue
+        {
+        public:
+            explicit SpscQueue(size_t capacity)
+                : slots(capacity)
+                , head(0)
+                , tail(0)
+                , nwaiting(0)
+            {
+                if (capacity == 0) {
+                    throw std::invalid_argument("Queue capacity must be positive");
+                }
+            }
+
+            /// non-blocking push, returns false if the queue is full
+            bool TryPush(T& value)
+            {
+                if (! PushIfRoom(value)) {
+                    return false;
+                }
+
+                WakeWaiting();
+
+                return true;
+            }
+
+            /// non-blocking pop, returns false if the queue is empty
+            bool TryPop(T& value)
+            {
+                if (! PopIfAny(value)) {
+                    return false;
+                }
+
+                WakeWaiting();
+
+                return true;
+            }
+
+            void Push(T value)
+            {
+                if (! PushIfRoom(value)) {
+                    Wait([&]() { return PushIfRoom(value); });
+                }
+
+                WakeWaiting();
+            }
+
+            T Pop()
+            {
+                T value;
+
+                if (! PopIfAny(value)) {
+                    Wait([&]() { return PopIfAny(value); });
+                }
+
+                WakeWaiting();
+
+                return value;
+            }
+
+        private:
+            bool PushIfRoom(T& value)
+            {
+                size_t curTail = tail.load(std::memory_order_relaxed);
+
+                if (curTail - head.load(std::memory_order_acquire) == slots.size()) {
+                    return false;
+                }
+
+                slots[curTail % slots.size()] = std::move(value);
+                tail.store(curTail + 1, std::memory_order_release);
+
+                return true;
+            }
+
+            bool PopIfAny(T& value)
+            {
+                size_t curHead = head.load(std::memory_order_relaxed);
+
+                if (curHead == tail.load(std::memory_order_acquire)) {
+                    return false;
+                }
+
+                value = std::move(slots[curHead % slots.size()]);
+                head.store(curHead + 1, std::memory_order_release);
+
+                return true;
+            }
+
+            /// retries the attempt, then sleeps until it succeeds
+            template <typename Attempt>
+            void Wait(Attempt attempt)
+            {
+                for (size_t spin = 0; spin < QUEUE_SPIN_LIMIT; ++spin) {
+                    std::this_thread::yield();
+
+                    if (attempt()) {
+                        return;
+                    }
+                }
+
+                std::unique_lock<std::mutex> lock(waitMutex);
+
+                // the other side either sees the sleeper or its change is seen by the attempt below
+                nwaiting.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                wakeup.wait(lock, attempt);
+                nwaiting.fetch_sub(1);
+            }
+
+            /// wakes the other side after the queue change if it sleeps
+            void WakeWaiting()
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+
+                if (nwaiting.load(std::memory_order_relaxed) != 0) {
+                    std::lock_guard<std::mutex> lock(waitMutex);
+                    wakeup.notify_all();
+                }
+            }
+
+            std::vector<T> slots;
+
+            alignas(CACHE_LINE_SIZE) std::atomic<size_t> head;
+            alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail;
+
+            alignas(CACHE_LINE_SIZE) std::atomic<size_t> nwaiting;
+            std::mutex waitMutex;
+            std::condition_variable wakeup;
+        };
+
+        /**
+         * \brief Runs three concurrent stages connected by bounded SPSC queues
+         *
+         * \details
+         * produce runs on its own thread and returns items until it returns nullptr,
+         * process runs on another thread for each produced item,
+         * consume runs on the calling thread for each processed item in the produced order.
+         * At most queueCapacity items wait between two neighbouring stages.
+         * \note
+         * If any stage throws, the remaining items are drained without processing and
+         * the first exception is rethrown after all stage threads are joined.
+         */
+        template <typename Item>
+        void RunThreeStagePipeline(size_t queueCapacity,
+                                   std::function<std::unique_ptr<Item> ()> produce,
+                                   std::function<void (Item&)> process,
+                                   std::function<void (Item&)> consume)
+        {
+            typedef std::unique_ptr<Item> ItemPtr;
+
+            SpscQueue<ItemPtr> produced(queueCapacity);
+            SpscQueue<ItemPtr> processed(queueCapacity);
+            std::exception_ptr produceError;
+            std::exception_ptr processError;
+            std::exception_ptr consumeError;
+            std::atomic<bool> failed(false);
+
+            // section: parse stage
+            std::thread producer([&]()
+            {
+                try
+                {
+                    for (ItemPtr item = produce(); item && ! failed.load(); item = produce()) {
+                        produced.Push(std::move(item));
+                    }
+                } catch (...) {
+                    produceError = std::current_exception();
+                    failed.store(true);
+                }
+
+                produced.Push(ItemPtr());
+            });
+
+            // section: decode stage
+            std::thread processor([&]()
+            {
+                for (ItemPtr item = produced.Pop(); item; item = produced.Pop()) {
+                    if (failed.load()) {
+                        continue;
+                    }
+
+                    try
+                    {
+                        process(*item);
+                        processed.Push(std::move(item));
+                    } catch (...) {
+                        processError = std::current_exception();
+                        failed.store(true);
+                    }
+                }
+
+                processed.Push(ItemPtr());
+            });
+
+            // section: output stage
+            for (ItemPtr item = processed.Pop(); item; item = processed.Pop()) {
+                if (failed.load()) {
+                    continue;
+                }
+
+                try
+                {
+                    consume(*item);
+                } catch (...) {
+                    consumeError = std::current_exception();
+                    failed.store(true);
+                }
+            }
+
+            producer.join();
+            processor.join();
+
+            if (produceError) {
+                std::rethrow_exception(produceError);
+            } else if (processError) {
+                std::rethrow_exception(processError);
+            } else if (consumeError) {
+                std::rethrow_exception(consumeError);
+            }
+        }
+    };
+};
+
+#endif // HMM_PIPELINE_H
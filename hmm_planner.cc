@@ -0,0 +1,447 @@
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "hmm_planner.h"
+
+using std::string;
+
+using HMM::Data::CompiledModel;
+using HMM::Algorithms::Kernel;
+using HMM::Algorithms::Variant;
+using HMM::Algorithms::EstimatePeakBytes;
+using HMM::Planning::ViterbiStorage;
+using HMM::Planning::PosteriorStorage;
+using HMM::Planning::ExecutionEnvironment;
+using HMM::Planning::ExecutionPlan;
+using HMM::Planning::KernelTuning;
+using HMM::Planning::TuningCache;
+
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ */
+namespace
+{
+    const char* KERNEL_NAMES[] = {"auto", "dense", "sparse"};
+    const char* VITERBI_STORAGE_NAMES[] = {"full", "checkpointed"};
+    const char* POSTERIOR_STORAGE_NAMES[] = {"linear-table", "scaled-streaming", "scaled-out-of-core"};
+    const char* PARALLELISM_NAMES[] = {"sequential", "parallel"};
+
+    /**
+     * \brief Aux. function to find the index of the value among the names
+     *
+     * \returns number of names if the value is not found
+     */
+    size_t FindName(const char* const* names, size_t nnames, const string& value)
+    {
+        return std::find(names, names + nnames, value) - names;
+    }
+
+    template <typename T, size_t N>
+    size_t CountOf(const T (&)[N])
+    {
+        return N;
+    }
+
+    /**
+     * \brief Aux. function to check that plain probabilities of the sequence can not underflow
+     *
+     * \details
+     * Every step multiplies the probability of any possible state sequence at least
+     * by the smallest non-zero transition and emission probabilities, so the likelihood
+     * and the largest posterior numerator stay normal doubles if nsteps such factors
+     * divided by the number of states do.
+     */
+    bool IsLinearPrecisionSafe(const CompiledModel& model, size_t nsteps)
+    {
+        double minProb = 1.;
+
+        for (size_t j = 0; j < model.nstates; ++j) {
+            if (model.initialProb[j] > 0) {
+                minProb = std::min(minProb, model.initialProb[j]);
+            }
+        }
+
+        for (size_t p = 0; p < model.predecessorProb.size(); ++p) {
+            minProb = std::min(minProb, model.predecessorProb[p]);
+        }
+
+        double minEmission = 1.;
+
+        for (size_t k = 0; k < model.stateSymbolProb.columnProb.size(); ++k) {
+            minEmission = std::min(minEmission, model.stateSymbolProb.columnProb[k]);
+        }
+
+        double minLogStep = std::log(minProb) + std::log(minEmission);
+        double logRange = -std::log(std::numeric_limits<double>::min());
+
+        return (-minLogStep * static_cast<double> (nsteps) +
+                std::log(static_cast<double> (std::max<size_t> (model.nstates, 1))) < logRange);
+    }
+
+    bool FitsBudget(size_t bytes, size_t memoryBudget)
+    {
+        return (memoryBudget == 0 || bytes <= memoryBudget);
+    }
+
+    /**
+     * \brief Sink dropping posteriors, lets the kernels be measured without consumers
+     */
+    class DiscardingSink : public HMM::Algorithms::PosteriorSink
+    {
+    public:
+        void ConsumePosteriors(size_t, size_t, size_t, const double*) override
+        {
+        }
+    };
+
+    /**
+     * \brief Aux. function to measure the fastest of the repeated runs in seconds
+     */
+    template <typename Run>
+    double MeasureFastestRun(Run run)
+    {
+        double fastest = std::numeric_limits<double>::max();
+
+        for (size_t i = 0; i < HMM::Planning::TUNING_REPEATS; ++i) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            run();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            fastest = std::min(fastest, elapsed.count());
+        }
+
+        return fastest;
+    }
+
+    const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+    const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    void HashBytes(const void* data, size_t size, uint64_t& hash)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*> (data);
+
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * FNV_PRIME;
+        }
+    }
+
+    template <typename Container>
+    void HashElements(const Container& elements, uint64_t& hash)
+    {
+        size_t size = elements.size();
+
+        HashBytes(&size, sizeof(size), hash);
+        HashBytes(elements.data(), size * sizeof(elements[0]), hash);
+    }
+};
+
+ExecutionEnvironment::ExecutionEnvironment()
+    : ncores(std::max(std::thread::hardware_concurrency(), 1u))
+    , memoryBudget(0)
+    , canSpill(false)
+{
+}
+
+ExecutionPlan::ExecutionPlan()
+    : kernel(Kernel::Auto)
+    , viterbiStorage(ViterbiStorage::Full)
+    , posteriorStorage(PosteriorStorage::LinearTable)
+    , parallelPasses(false)
+    , concurrentAlgorithms(false)
+{
+}
+
+string ExecutionPlan::Describe() const
+{
+    std::ostringstream description;
+
+    description << "kernel=" << KERNEL_NAMES[static_cast<size_t> (kernel)]
+                << " viterbi=" << VITERBI_STORAGE_NAMES[static_cast<size_t> (viterbiStorage)]
+                << " posteriors=" << POSTERIOR_STORAGE_NAMES[static_cast<size_t> (posteriorStorage)]
+                << " passes=" << PARALLELISM_NAMES[parallelPasses ? 1 : 0]
+                << " algorithms=" << PARALLELISM_NAMES[concurrentAlgorithms ? 1 : 0];
+
+    return description.str();
+}
+
+void ExecutionPlan::Override(const string& settings)
+{
+    std::istringstream source(settings);
+    string setting;
+
+    while (std::getline(source, setting, ',')) {
+        size_t separator = setting.find('=');
+        string name = setting.substr(0, separator);
+        string value = (separator == string::npos ? string() : setting.substr(separator + 1));
+        size_t index = 0;
+
+        if (name == "kernel" &&
+            (index = FindName(KERNEL_NAMES, CountOf(KERNEL_NAMES), value)) < CountOf(KERNEL_NAMES)) {
+            kernel = static_cast<Kernel> (index);
+        } else if (name == "viterbi" &&
+                   (index = FindName(VITERBI_STORAGE_NAMES, CountOf(VITERBI_STORAGE_NAMES), value)) <
+                   CountOf(VITERBI_STORAGE_NAMES)) {
+            viterbiStorage = static_cast<ViterbiStorage> (index);
+        } else if (name == "posteriors" &&
+                   (index = FindName(POSTERIOR_STORAGE_NAMES, CountOf(POSTERIOR_STORAGE_NAMES), value)) <
+                   CountOf(POSTERIOR_STORAGE_NAMES)) {
+            posteriorStorage = static_cast<PosteriorStorage> (index);
+        } else if (name == "passes" &&
+                   (index = FindName(PARALLELISM_NAMES, CountOf(PARALLELISM_NAMES), value)) <
+                   CountOf(PARALLELISM_NAMES)) {
+            parallelPasses = (index == 1);
+        } else if (name == "algorithms" &&
+                   (index = FindName(PARALLELISM_NAMES, CountOf(PARALLELISM_NAMES), value)) <
+                   CountOf(PARALLELISM_NAMES)) {
+            concurrentAlgorithms = (index == 1);
+        } else {
+            throw std::invalid_argument("Unknown plan setting '" + setting + "'");
+        }
+    }
+}
+
+void ExecutionPlan::Check(const ExecutionEnvironment& environment) const
+{
+    if (posteriorStorage == PosteriorStorage::ScaledOutOfCore && ! environment.canSpill) {
+        throw std::invalid_argument("Out-of-core posteriors need a scratch directory");
+    }
+}
+
+void ExecutionPlan::Apply(Algorithms::Workspace& workspace) const
+{
+    workspace.kernel = kernel;
+    workspace.parallelPasses = parallelPasses;
+}
+
+KernelTuning::KernelTuning()
+    : kernel(Kernel::Auto)
+    , parallelPasses(true)
+{
+}
+
+KernelTuning HMM::Planning::TuneKernels(const CompiledModel& model, const ExecutionEnvironment& environment,
+                                        size_t sampleSteps)
+{
+    KernelTuning tuning;
+
+    if (model.nsymbols == 0 || sampleSteps == 0) {
+        return tuning;
+    }
+
+    // section: sample sequence of the emitted symbols, linear congruential generator keeps it reproducible
+    std::vector<size_t> sample(sampleSteps);
+    uint64_t state = FNV_OFFSET_BASIS;
+
+    for (size_t t = 0; t < sampleSteps; ++t) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        sample[t] = model.compiledToOriginalSymbol[(state >> 33) % model.nsymbols];
+    }
+
+    Data::ColumnView symbols(sample.data(), sampleSteps, sizeof(size_t), sizeof(size_t));
+    Algorithms::Workspace workspace;
+    std::vector<size_t> mostProbableSeq;
+    DiscardingSink sink;
+
+    // section: dense and sparse kernels, the first runs warm up the workspace
+    double fastest = std::numeric_limits<double>::max();
+    const Kernel kernels[] = {Kernel::Dense, Kernel::Sparse};
+
+    for (size_t i = 0; i < CountOf(kernels); ++i) {
+        workspace.kernel = kernels[i];
+
+        double elapsed = MeasureFastestRun([&]()
+        {
+            Algorithms::FindMostProbableStateSequence(model, symbols, workspace, mostProbableSeq);
+            Algorithms::StreamPosteriorProbabilities(model, symbols, sink, workspace);
+        });
+
+        if (elapsed < fastest) {
+            fastest = elapsed;
+            tuning.kernel = kernels[i];
+        }
+    }
+
+    // section: sequential and parallel passes with the faster kernel
+    if (environment.ncores < 2) {
+        return tuning;
+    }
+
+    workspace.kernel = tuning.kernel;
+
+    double elapsed[2];
+
+    for (size_t i = 0; i < 2; ++i) {
+        workspace.parallelPasses = (i == 1);
+        elapsed[i] = MeasureFastestRun([&]()
+        {
+            Algorithms::CalcForwardBackwardProbabiliies(model, symbols, workspace);
+        });
+    }
+
+    tuning.parallelPasses = (elapsed[1] < elapsed[0]);
+
+    return tuning;
+}
+
+uint64_t HMM::Planning::HashModel(const CompiledModel& model)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    HashBytes(&model.nmodelStates, sizeof(model.nmodelStates), hash);
+    HashBytes(&model.nmodelSymbols, sizeof(model.nmodelSymbols), hash);
+    HashElements(model.compiledToOriginal, hash);
+    HashElements(model.compiledToOriginalSymbol, hash);
+    HashElements(model.initialProb, hash);
+    HashElements(model.transitionProb, hash);
+    HashElements(model.stateSymbolProb.columnStart, hash);
+    HashElements(model.stateSymbolProb.columnState, hash);
+    HashElements(model.stateSymbolProb.columnProb, hash);
+    HashElements(model.eliminatedSuccessor, hash);
+    HashElements(model.eliminatedProb, hash);
+
+    return hash;
+}
+
+string HMM::Planning::HostCpuModel()
+{
+    std::ifstream cpuInfo("/proc/cpuinfo");
+    string line;
+
+    while (std::getline(cpuInfo, line)) {
+        size_t separator = line.find(':');
+
+        if (line.compare(0, 10, "model name") == 0 && separator != string::npos) {
+            size_t first = line.find_first_not_of(" \t", separator + 1);
+            return (first == string::npos ? string("unknown") : line.substr(first));
+        }
+    }
+
+    return "unknown";
+}
+
+TuningCache::TuningCache(const string& path)
+    : path(path)
+{
+    std::ifstream source(path.c_str());
+    string line;
+
+    while (std::getline(source, line)) {
+        std::istringstream fields(line);
+        string hashField;
+        string cpuModel;
+        string settings;
+
+        if (! std::getline(fields, hashField, '\t') || ! std::getline(fields, cpuModel, '\t') ||
+            ! std::getline(fields, settings)) {
+            continue;
+        }
+
+        uint64_t modelHash = 0;
+        std::istringstream hashSource(hashField);
+        ExecutionPlan plan;
+
+        if (! (hashSource >> std::hex >> modelHash)) {
+            continue;
+        }
+
+        // tunings use the plan setting names, so the plan parses them
+        try
+        {
+            plan.Override(settings);
+        } catch(std::invalid_argument&) {
+            continue;
+        }
+
+        KernelTuning& tuning = tunings[std::make_pair(modelHash, cpuModel)];
+        tuning.kernel = plan.kernel;
+        tuning.parallelPasses = plan.parallelPasses;
+    }
+}
+
+bool TuningCache::Find(uint64_t modelHash, const string& cpuModel, KernelTuning& tuning) const
+{
+    std::map<std::pair<uint64_t, string>, KernelTuning>::const_iterator found =
+        tunings.find(std::make_pair(modelHash, cpuModel));
+
+    if (found == tunings.end()) {
+        return false;
+    }
+
+    tuning = found->second;
+
+    return true;
+}
+
+void TuningCache::Store(uint64_t modelHash, const string& cpuModel, const KernelTuning& tuning)
+{
+    tunings[std::make_pair(modelHash, cpuModel)] = tuning;
+
+    std::ofstream target(path.c_str(), std::ios_base::app);
+    target.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+    target << std::hex << std::setw(16) << std::setfill('0') << modelHash << '\t' << cpuModel << '\t'
+           << "kernel=" << KERNEL_NAMES[static_cast<size_t> (tuning.kernel)]
+           << ",passes=" << PARALLELISM_NAMES[tuning.parallelPasses ? 1 : 0] << '\n';
+}
+
+ExecutionPlan HMM::Planning::PlanExecution(const CompiledModel& model, size_t nsteps,
+                                           const ExecutionEnvironment& environment,
+                                           const KernelTuning& tuning)
+{
+    ExecutionPlan plan;
+    size_t memoryBudget = environment.memoryBudget;
+
+    // section: tuned kernel or the one by the transition density
+    if (tuning.kernel != Kernel::Auto) {
+        plan.kernel = tuning.kernel;
+    } else {
+        plan.kernel = (model.preferSparse ? Kernel::Sparse : Kernel::Dense);
+    }
+
+    // section: storage of the Viterbi backpointers
+    size_t viterbiBytes = EstimatePeakBytes(model, nsteps, Variant::Viterbi);
+
+    if (! FitsBudget(viterbiBytes, memoryBudget)) {
+        plan.viterbiStorage = ViterbiStorage::Checkpointed;
+        viterbiBytes = EstimatePeakBytes(model, nsteps, Variant::CheckpointedViterbi);
+    }
+
+    // section: precision and storage of the posteriors
+    size_t posteriorBytes = EstimatePeakBytes(model, nsteps, Variant::ForwardBackward);
+
+    if (! IsLinearPrecisionSafe(model, nsteps) || ! FitsBudget(posteriorBytes, memoryBudget)) {
+        plan.posteriorStorage = PosteriorStorage::ScaledStreaming;
+        posteriorBytes = EstimatePeakBytes(model, nsteps, Variant::StreamingPosteriors);
+
+        if (! FitsBudget(posteriorBytes, memoryBudget) && environment.canSpill) {
+            plan.posteriorStorage = PosteriorStorage::ScaledOutOfCore;
+            posteriorBytes = EstimatePeakBytes(model, nsteps, Variant::OutOfCorePosteriors);
+        }
+    }
+
+    // section: parallelism for large trellises only
+    size_t freeCores = environment.ncores;
+
+    if (nsteps * model.nstates < PARALLEL_MIN_CELLS) {
+        return plan;
+    }
+
+    if (freeCores >= 2 && FitsBudget(viterbiBytes + posteriorBytes, memoryBudget)) {
+        plan.concurrentAlgorithms = true;
+        --freeCores;
+    }
+
+    if (freeCores >= 2 && plan.posteriorStorage == PosteriorStorage::LinearTable && tuning.parallelPasses) {
+        plan.parallelPasses = true;
+    }
+
+    return plan;
+}
@@ -0,0 +1,200 @@
+#ifndef HMM_PLANNER_H
+#define HMM_PLANNER_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "hmm.h"
+
+
+/**
+ * \note
+ * Execution planner choosing algorithm variants for a model and a sequence length,
+ * so callers do not have to pick kernels, storage and parallelism by hand.
+ */
+namespace HMM
+{
+    namespace Planning
+    {
+        using Data::CompiledModel;
+
+        /// at least this number of trellis cells is worth an additional thread
+        const size_t PARALLEL_MIN_CELLS = 1 << 16;
+
+        /// number of steps of the sample sequence the kernels are measured on
+        const size_t TUNING_SAMPLE_STEPS = 1 << 12;
+
+        /// every candidate is measured this number of times, the fastest run counts
+        const size_t TUNING_REPEATS = 3;
+
+        /**
+         * \brief Storage of the Viterbi backpointers
+         *
+         * Full keeps maxtime x nstates backpointers, Checkpointed keeps one segment
+         * (see Algorithms::FindMostProbableStateSequenceCheckpointed).
+         */
+        enum class ViterbiStorage
+        {
+            Full,
+            Checkpointed
+        };
+
+        /**
+         * \brief Precision and storage of the posterior probabilities
+         *
+         * LinearTable is the maxtime x nstates table of plain forward and backward
+         * probabilities (Algorithms::CalcForwardBackwardProbabiliies), it underflows
+         * on long sequences. Scaled variants normalise every step and stream posteriors
+         * keeping the backward table in memory (ScaledStreaming) or the forward table
+         * in a scratch file (ScaledOutOfCore).
+         */
+        enum class PosteriorStorage
+        {
+            LinearTable,
+            ScaledStreaming,
+            ScaledOutOfCore
+        };
+
+        /**
+         * \brief Resources available for the execution
+         */
+        struct ExecutionEnvironment
+        {
+            /// takes the number of hardware threads, no memory budget and no scratch directory
+            ExecutionEnvironment();
+
+            size_t ncores;
+
+            /// limit of the estimated memory of each algorithm call in bytes, zero if unlimited
+            size_t memoryBudget;
+
+            /// true if a scratch directory for the out-of-core variants is available
+            bool canSpill;
+        };
+
+        /**
+         * \brief Chosen variants of the algorithms for one sequence
+         */
+        struct ExecutionPlan
+        {
+            ExecutionPlan();
+
+            Algorithms::Kernel kernel;
+            ViterbiStorage viterbiStorage;
+            PosteriorStorage posteriorStorage;
+
+            /// forward and backward passes of the linear table run on two threads
+            bool parallelPasses;
+
+            /// the Viterbi algorithm and the posterior calculation run on two threads
+            bool concurrentAlgorithms;
+
+            /// one line description, e.g. "kernel=dense viterbi=full posteriors=linear-table ..."
+            std::string Describe() const;
+
+            /**
+             * \brief Overrides the decisions by comma separated name=value settings
+             *
+             * \details
+             * Settings use the Describe() names and values, e.g. "kernel=sparse,passes=sequential".
+             * Names are kernel (auto, dense, sparse), viterbi (full, checkpointed),
+             * posteriors (linear-table, scaled-streaming, scaled-out-of-core),
+             * passes and algorithms (sequential, parallel).
+             * \note
+             * Unknown settings are reported by std::invalid_argument exceptions.
+             */
+            void Override(const std::string& settings);
+
+            /**
+             * \brief Checks that the environment can run the plan, e.g. after overrides
+             *
+             * \note
+             * Out-of-core posteriors without a scratch directory are reported by std::invalid_argument.
+             */
+            void Check(const ExecutionEnvironment& environment) const;
+
+            /// sets kernel and parallel passes of the workspace
+            void Apply(Algorithms::Workspace& workspace) const;
+        };
+
+        /**
+         * \brief Kernel choices measured on the host for a model
+         */
+        struct KernelTuning
+        {
+            /// untuned choices: kernel by the transition density, parallel passes are allowed
+            KernelTuning();
+
+            Algorithms::Kernel kernel;
+
+            /// false if the passes on two threads were not faster than on one
+            bool parallelPasses;
+        };
+
+        /**
+         * \brief Measures the kernels on a sample sequence and picks the fastest ones
+         *
+         * \details
+         * Dense and sparse kernels are measured by the Viterbi algorithm and the streamed
+         * posteriors, then sequential and parallel forward-backward passes with the faster kernel
+         * if there are at least two cores. The sample sequence cycles pseudo-randomly
+         * over the emitted symbols, so the sample probabilities do not matter.
+         */
+        KernelTuning TuneKernels(const CompiledModel& model, const ExecutionEnvironment& environment,
+                                 size_t sampleSteps = TUNING_SAMPLE_STEPS);
+
+        /// FNV-1a hash of the compiled model tables, equal for equal models
+        uint64_t HashModel(const CompiledModel& model);
+
+        /// model name of the host CPU from /proc/cpuinfo, "unknown" if not available
+        std::string HostCpuModel();
+
+        /**
+         * \brief Kernel tunings persisted in a text file
+         *
+         * \details
+         * Every line is "model hash<TAB>CPU model<TAB>kernel=name,passes=name", see output.spec.
+         * Later lines of the same key win, malformed lines are ignored.
+         */
+        class TuningCache
+        {
+        public:
+            /// loads the file if it exists
+            explicit TuningCache(const std::string& path);
+
+            bool Find(uint64_t modelHash, const std::string& cpuModel, KernelTuning& tuning) const;
+
+            /**
+             * \brief Adds tuning and appends it to the file
+             *
+             * \note
+             * Write errors are reported by std::ios_base::failure exceptions.
+             */
+            void Store(uint64_t modelHash, const std::string& cpuModel, const KernelTuning& tuning);
+
+        private:
+            std::string path;
+            std::map<std::pair<uint64_t, std::string>, KernelTuning> tunings;
+        };
+
+        /**
+         * \brief Chooses variants of the algorithms for the sequence of nsteps steps
+         *
+         * \details
+         * Kernel is the tuned one or follows the transition density of the model. Linear posteriors are chosen
+         * only when the sequence is provably too short to underflow, otherwise scaled ones,
+         * which move out of core when the budget is exceeded and spilling is possible.
+         * Viterbi backpointers are checkpointed when the full table exceeds the budget.
+         * Additional threads are used for large trellises if there are free cores
+         * and the budget allows concurrent tables, parallel passes only if the tuning allows them.
+         */
+        ExecutionPlan PlanExecution(const CompiledModel& model, size_t nsteps,
+                                    const ExecutionEnvironment& environment,
+                                    const KernelTuning& tuning = KernelTuning());
+    };
+};
+
+#endif // HMM_PLANNER_H
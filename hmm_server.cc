@@ -0,0 +1,525 @@
+#include <limits>
+#include <thread>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "hmm_server.h"
+#include "hmm_planner.h"
+
+using std::string;
+using std::vector;
+
+using HMM::Data::ColumnView;
+using HMM::Server::RequestKind;
+using HMM::Server::RequestHeader;
+using HMM::Server::ReplyHeader;
+using HMM::Server::ServedModel;
+using HMM::Server::ModelRegistry;
+using HMM::Server::ServerOptions;
+using HMM::Server::DecodingServer;
+
+/**
+ * \note
+ * Auxiliary functions, for internal usage only.
+ */
+namespace
+{
+    void ThrowSystemError(const string& what)
+    {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    /**
+     * \brief Aux. function to receive exactly size bytes
+     *
+     * \returns false if the connection is closed or fails
+     */
+    bool ReceiveAll(int connection, void* buffer, size_t size)
+    {
+        unsigned char* bytes = static_cast<unsigned char*> (buffer);
+
+        while (size != 0) {
+            ssize_t received = recv(connection, bytes, size, 0);
+
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (received <= 0) {
+                return false;
+            }
+
+            bytes += received;
+            size -= received;
+        }
+
+        return true;
+    }
+
+    /**
+     * \brief Aux. function to send exactly size bytes
+     *
+     * \returns false if the connection is closed or fails
+     */
+    bool SendAll(int connection, const void* buffer, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*> (buffer);
+
+        while (size != 0) {
+            ssize_t sent = send(connection, bytes, size, MSG_NOSIGNAL);
+
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (sent <= 0) {
+                return false;
+            }
+
+            bytes += sent;
+            size -= sent;
+        }
+
+        return true;
+    }
+
+    /**
+     * \brief Aux. sink copying posteriors into the reply after its header
+     */
+    class ReplySink : public HMM::Algorithms::PosteriorSink
+    {
+    public:
+        explicit ReplySink(vector<unsigned char>& reply)
+            : reply(reply)
+        {
+        }
+
+        void ConsumePosteriors(size_t firstStep, size_t nsteps, size_t nstates, const double* posteriors)
+        {
+            std::memcpy(reply.data() + sizeof(ReplyHeader) + firstStep * nstates * sizeof(double),
+                        posteriors, nsteps * nstates * sizeof(double));
+        }
+
+    private:
+        vector<unsigned char>& reply;
+    };
+}
+
+/**
+ * \brief Storage of a worker reused by all its requests
+ */
+struct DecodingServer::Worker
+{
+    size_t index;
+    HMM::Algorithms::Workspace workspace;
+    vector<uint32_t> symbols;
+    vector<size_t> states;
+
+    /// reply header and payload
+    vector<unsigned char> reply;
+};
+
+/// announced by readers outside of guards
+const uint64_t IDLE_EPOCH = std::numeric_limits<uint64_t>::max();
+
+ModelRegistry::ReaderEpoch::ReaderEpoch()
+    : epoch(IDLE_EPOCH)
+{
+}
+
+ModelRegistry::ModelRegistry(size_t nmodels, size_t nreaders)
+    : nmodels(nmodels)
+    , slots(new std::atomic<const ServedModel*>[nmodels])
+    , globalEpoch(0)
+    , readerEpochs(nreaders)
+    , hasRetired(false)
+{
+    for (size_t m = 0; m < nmodels; ++m) {
+        slots[m].store(0);
+    }
+}
+
+ModelRegistry::~ModelRegistry()
+{
+    for (size_t m = 0; m < nmodels; ++m) {
+        delete slots[m].load();
+    }
+
+    for (size_t r = 0; r < retired.size(); ++r) {
+        delete retired[r].second;
+    }
+}
+
+void ModelRegistry::Publish(size_t index, std::unique_ptr<const ServedModel> model)
+{
+    if (index >= nmodels) {
+        throw std::invalid_argument("Model index is out of the registry");
+    }
+
+    // readers announcing the advanced epoch load pointers after the swap, so they see the new version
+    const ServedModel* previous = slots[index].exchange(model.release());
+    uint64_t retiredEpoch = globalEpoch.fetch_add(1) + 1;
+
+    if (previous != 0) {
+        std::lock_guard<std::mutex> lock(retiredMutex);
+        retired.push_back(std::make_pair(retiredEpoch, previous));
+        hasRetired.store(true);
+    }
+
+    Reclaim(false);
+}
+
+size_t ModelRegistry::RetiredCount()
+{
+    std::lock_guard<std::mutex> lock(retiredMutex);
+
+    return retired.size();
+}
+
+void ModelRegistry::Reclaim(bool tryOnly)
+{
+    std::unique_lock<std::mutex> lock(retiredMutex, std::defer_lock);
+
+    if (tryOnly) {
+        if (! lock.try_lock()) {
+            return;
+        }
+    } else {
+        lock.lock();
+    }
+
+    // section: the oldest epoch still announced by a reader
+    uint64_t oldestEpoch = IDLE_EPOCH;
+
+    for (size_t r = 0; r < readerEpochs.size(); ++r) {
+        oldestEpoch = std::min(oldestEpoch, readerEpochs[r].epoch.load());
+    }
+
+    // section: versions retired after every announcement can not be held by any reader
+    size_t kept = 0;
+
+    for (size_t r = 0; r < retired.size(); ++r) {
+        if (retired[r].first <= oldestEpoch) {
+            delete retired[r].second;
+        } else {
+            retired[kept++] = retired[r];
+        }
+    }
+
+    retired.resize(kept);
+    hasRetired.store(kept != 0);
+}
+
+ModelRegistry::ReadGuard::ReadGuard(ModelRegistry& registry, size_t reader)
+    : registry(registry)
+    , reader(reader)
+{
+    if (reader >= registry.readerEpochs.size()) {
+        throw std::invalid_argument("Reader index is out of the registry readers");
+    }
+
+    registry.readerEpochs[reader].epoch.store(registry.globalEpoch.load());
+}
+
+ModelRegistry::ReadGuard::~ReadGuard()
+{
+    registry.readerEpochs[reader].epoch.store(IDLE_EPOCH);
+
+    if (registry.hasRetired.load()) {
+        registry.Reclaim(true);
+    }
+}
+
+const ServedModel* ModelRegistry::ReadGuard::Get(size_t index) const
+{
+    return (index < registry.nmodels ? registry.slots[index].load() : 0);
+}
+
+ServerOptions::ServerOptions()
+    : nworkers(std::max(std::thread::hardware_concurrency(), 1u))
+    , memoryBudget(0)
+    , pageBacking(Memory::PageBacking::Heap)
+    , maxRequestSteps(DEFAULT_MAX_REQUEST_STEPS)
+{
+}
+
+DecodingServer::DecodingServer(ModelRegistry& models, const ServerOptions& options)
+    : models(models)
+    , options(options)
+    , stopped(false)
+    , listeningSocket(-1)
+    , connections(new std::atomic<int>[std::max(options.nworkers, static_cast<size_t> (1))])
+{
+    if (options.nworkers == 0) {
+        throw std::invalid_argument("Server needs at least one worker");
+    }
+
+    if (models.ReaderCount() < options.nworkers) {
+        throw std::invalid_argument("Model registry has fewer readers than the server workers");
+    }
+
+    for (size_t w = 0; w < options.nworkers; ++w) {
+        connections[w].store(-1);
+    }
+
+    std::fill(workspaceCapacity, workspaceCapacity + 3, 0);
+}
+
+void DecodingServer::Run(const string& socketPath)
+{
+    // section: listening socket at the path
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path is too long: " + socketPath);
+    }
+
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+    int listening = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if (listening < 0) {
+        ThrowSystemError("Failed to create socket");
+    }
+
+    unlink(socketPath.c_str());
+
+    if (bind(listening, reinterpret_cast<sockaddr*> (&address), sizeof(address)) != 0 ||
+        listen(listening, SOMAXCONN) != 0) {
+        int error = errno;
+        close(listening);
+        errno = error;
+        ThrowSystemError("Failed to listen on " + socketPath);
+    }
+
+    listeningSocket.store(listening);
+
+    // section: workers accept and serve connections until stopped
+    vector<Worker> workers(options.nworkers);
+    vector<std::thread> threads;
+
+    for (size_t w = 0; w < workers.size(); ++w) {
+        workers[w].index = w;
+        workers[w].workspace.arena.SetPageBacking(options.pageBacking);
+        workers[w].workspace.memoryBudget = options.memoryBudget;
+    }
+
+    // a stop requested before listening started is applied now
+    if (stopped.load()) {
+        shutdown(listening, SHUT_RDWR);
+    }
+
+    for (size_t w = 0; w < workers.size(); ++w) {
+        threads.push_back(std::thread(&DecodingServer::Serve, this, std::ref(workers[w])));
+    }
+
+    for (size_t w = 0; w < threads.size(); ++w) {
+        threads[w].join();
+    }
+
+    for (size_t b = 0; b < 3; ++b) {
+        workspaceCapacity[b] = 0;
+
+        for (size_t w = 0; w < workers.size(); ++w) {
+            workspaceCapacity[b] += workers[w].workspace.arena.Capacity(static_cast<Memory::PageBacking> (b));
+        }
+    }
+
+    listeningSocket.store(-1);
+    close(listening);
+    unlink(socketPath.c_str());
+}
+
+void DecodingServer::Stop()
+{
+    stopped.store(true);
+
+    int listening = listeningSocket.load();
+
+    if (listening >= 0) {
+        shutdown(listening, SHUT_RDWR);
+    }
+
+    for (size_t w = 0; w < options.nworkers; ++w) {
+        int connection = connections[w].load();
+
+        if (connection >= 0) {
+            shutdown(connection, SHUT_RDWR);
+        }
+    }
+}
+
+size_t DecodingServer::WorkspaceCapacity(Memory::PageBacking backing) const
+{
+    return workspaceCapacity[static_cast<size_t> (backing)];
+}
+
+void DecodingServer::Serve(Worker& worker)
+{
+    while (! stopped.load()) {
+        int connection = accept4(listeningSocket.load(), 0, 0, SOCK_CLOEXEC);
+
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+
+            // the listening socket is shut down
+            return;
+        }
+
+        connections[worker.index].store(connection);
+
+        // a stop between accept and publishing the connection is not missed
+        if (stopped.load()) {
+            shutdown(connection, SHUT_RDWR);
+        }
+
+        while (ServeRequest(worker, connection)) {
+        }
+
+        connections[worker.index].store(-1);
+        close(connection);
+    }
+}
+
+bool DecodingServer::ServeRequest(Worker& worker, int connection)
+{
+    RequestHeader request;
+
+    if (! ReceiveAll(connection, &request, sizeof(request))) {
+        return false;
+    }
+
+    vector<unsigned char>& reply = worker.reply;
+    ReplyHeader header = {STATUS_OK, 0, 0, 0};
+    string error;
+
+    // section: check the request, a malformed header leaves the stream unsynchronised
+    if (request.magic != REQUEST_MAGIC) {
+        error = "Malformed request header";
+    } else if (request.nsteps > options.maxRequestSteps) {
+        error = "Sequence is longer than the server limit";
+    } else {
+        worker.symbols.resize(request.nsteps);
+
+        if (! ReceiveAll(connection, worker.symbols.data(), request.nsteps * sizeof(uint32_t))) {
+            return false;
+        }
+
+        if (request.model >= models.Size()) {
+            error = "Unknown model index";
+        } else if (request.nsteps == 0) {
+            error = "Sequence is empty";
+        }
+    }
+
+    // section: run the requested algorithm on the model version current at the request start
+    if (error.empty()) {
+        // the version is released before the reply is sent, so a slow client does not delay reclamation
+        ModelRegistry::ReadGuard guard(models, worker.index);
+        const ServedModel* served = guard.Get(request.model);
+        ColumnView symbols(worker.symbols.data(), worker.symbols.size(), sizeof(uint32_t), sizeof(uint32_t));
+
+        try
+        {
+            if (served == 0) {
+                throw std::invalid_argument("Model is not published");
+            }
+
+            const CompiledModel& model = served->compiledModel;
+
+            for (size_t t = 0; t < symbols.size(); ++t) {
+                if (symbols[t] >= model.nmodelSymbols) {
+                    throw std::invalid_argument("Symbol index is out of the model symbols");
+                }
+            }
+
+            // requests are served concurrently by all workers, so every request gets one core
+            HMM::Planning::ExecutionEnvironment environment;
+            environment.ncores = 1;
+            environment.memoryBudget = options.memoryBudget;
+
+            HMM::Planning::ExecutionPlan plan = HMM::Planning::PlanExecution(model, symbols.size(), environment);
+            plan.Apply(worker.workspace);
+
+            switch (static_cast<RequestKind> (request.kind)) {
+            case RequestKind::Decode:
+                if (plan.viterbiStorage == HMM::Planning::ViterbiStorage::Checkpointed) {
+                    HMM::Algorithms::FindMostProbableStateSequenceCheckpointed(model, symbols, worker.workspace,
+                                                                               worker.states);
+                } else {
+                    HMM::Algorithms::FindMostProbableStateSequence(model, symbols, worker.workspace,
+                                                                   worker.states);
+                }
+
+                header = {STATUS_OK, request.nsteps, 1, sizeof(uint32_t)};
+                reply.resize(sizeof(header) + worker.states.size() * sizeof(uint32_t));
+
+                for (size_t t = 0; t < worker.states.size(); ++t) {
+                    uint32_t state = static_cast<uint32_t> (worker.states[t]);
+                    std::memcpy(reply.data() + sizeof(header) + t * sizeof(state), &state, sizeof(state));
+                }
+
+                break;
+            case RequestKind::Score:
+            {
+                double logLikelihood = HMM::Algorithms::CalcLogLikelihood(model, symbols, worker.workspace);
+
+                header = {STATUS_OK, 1, 1, sizeof(double)};
+                reply.resize(sizeof(header) + sizeof(logLikelihood));
+                std::memcpy(reply.data() + sizeof(header), &logLikelihood, sizeof(logLikelihood));
+                break;
+            }
+            case RequestKind::Posteriors:
+            {
+                ReplySink sink(reply);
+                size_t replyBytes = symbols.size() * model.nmodelStates * sizeof(double);
+
+                // the reply holds the whole posterior table, so it counts against the budget with the algorithm
+                if (options.memoryBudget != 0) {
+                    size_t peakBytes = replyBytes +
+                        HMM::Algorithms::EstimatePeakBytes(model, symbols.size(),
+                                                           HMM::Algorithms::Variant::StreamingPosteriors,
+                                                           HMM::Algorithms::DEFAULT_BLOCK_STEPS);
+
+                    if (peakBytes > options.memoryBudget) {
+                        throw std::length_error("Estimated memory of " + std::to_string(peakBytes) +
+                                                " bytes exceeds the budget of " +
+                                                std::to_string(options.memoryBudget) + " bytes");
+                    }
+                }
+
+                header = {STATUS_OK, request.nsteps, static_cast<uint32_t> (model.nmodelStates), sizeof(double)};
+                reply.resize(sizeof(header) + replyBytes);
+                HMM::Algorithms::StreamPosteriorProbabilities(model, symbols, sink, worker.workspace);
+                break;
+            }
+            default:
+                throw std::invalid_argument("Unknown request kind");
+            }
+        } catch(std::exception& e) {
+            error = e.what();
+        }
+    }
+
+    if (! error.empty()) {
+        header = {STATUS_ERROR, static_cast<uint32_t> (error.size()), 1, 1};
+        reply.resize(sizeof(header) + error.size());
+        std::memcpy(reply.data() + sizeof(header), error.data(), error.size());
+    }
+
+    std::memcpy(reply.data(), &header, sizeof(header));
+
+    return SendAll(connection, reply.data(), reply.size()) && request.magic == REQUEST_MAGIC &&
+           request.nsteps <= options.maxRequestSteps;
+}
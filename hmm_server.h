@@ -0,0 +1,251 @@
+#ifndef HMM_SERVER_H
+#define HMM_SERVER_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "hmm.h"
+
+
+/**
+ * \note
+ * Persistent decoding server: models are read and compiled once and requests
+ * arrive over a local Unix domain socket (the protocol is described in output.spec).
+ */
+namespace HMM
+{
+    namespace Server
+    {
+        using Data::Model;
+        using Data::CompiledModel;
+
+        /// "HMMQ" in the little-endian byte order, first field of every request
+        const uint32_t REQUEST_MAGIC = 0x514d4d48;
+
+        /// longest accepted sequence, protects workers from allocating huge tables by a malformed request
+        const uint32_t DEFAULT_MAX_REQUEST_STEPS = 1 << 24;
+
+        /**
+         * \brief Kind of the request
+         *
+         * Decode replies the most probable state sequence, Score the log-likelihood
+         * of the sequence and Posteriors the nsteps x nstates posterior probabilities.
+         */
+        enum class RequestKind : uint8_t
+        {
+            Decode = 1,
+            Score = 2,
+            Posteriors = 3
+        };
+
+        /**
+         * \brief Request header, followed by nsteps 4-byte model symbol indices
+         */
+        struct RequestHeader
+        {
+            uint32_t magic;
+            uint8_t kind;
+            uint8_t reserved[3];
+
+            /// index of the served model
+            uint32_t model;
+            uint32_t nsteps;
+        };
+
+        /// reply statuses
+        const uint32_t STATUS_OK = 0;
+        const uint32_t STATUS_ERROR = 1;
+
+        /**
+         * \brief Reply header, followed by nrows x ncols elements of elementSize bytes
+         *
+         * \note
+         * Errors reply STATUS_ERROR and the message of nrows 1-byte characters.
+         */
+        struct ReplyHeader
+        {
+            uint32_t status;
+            uint32_t nrows;
+            uint32_t ncols;
+            uint32_t elementSize;
+        };
+
+        /**
+         * \brief Model ready to be served
+         */
+        struct ServedModel
+        {
+            std::string name;
+            Model model;
+            CompiledModel compiledModel;
+        };
+
+        /**
+         * \brief Served models which may be replaced by new versions while requests are decoded
+         *
+         * \details
+         * Every model slot holds an atomic pointer to an immutable model version. Readers
+         * announce the current epoch before loading pointers and withdraw it after the request,
+         * both lock-free. Publish swaps the pointer, advances the epoch and retires the old version,
+         * which is deleted once no reader announces an epoch older than its retirement,
+         * i.e. once the last reader that could see it drains. Reclamation is attempted
+         * by Publish and by every reader leaving while versions are retired, readers never wait for it.
+         */
+        class ModelRegistry
+        {
+        public:
+            /// nmodels empty slots read by at most nreaders concurrent readers
+            ModelRegistry(size_t nmodels, size_t nreaders);
+
+            ~ModelRegistry();
+
+            size_t Size() const
+            {
+                return nmodels;
+            }
+
+            size_t ReaderCount() const
+            {
+                return readerEpochs.size();
+            }
+
+            /// replaces the version of the model, readers which already hold the old one keep it
+            void Publish(size_t index, std::unique_ptr<const ServedModel> model);
+
+            /// number of replaced versions not deleted yet
+            size_t RetiredCount();
+
+            /**
+             * \brief Access of one reader to consistent model versions for the guard lifetime
+             *
+             * \note
+             * Every reader index is used by one thread at a time.
+             */
+            class ReadGuard
+            {
+            public:
+                ReadGuard(ModelRegistry& registry, size_t reader);
+                ~ReadGuard();
+
+                /// current version of the model, 0 if the slot is empty
+                const ServedModel* Get(size_t index) const;
+
+            private:
+                ReadGuard(const ReadGuard&);
+                ReadGuard& operator=(const ReadGuard&);
+
+                ModelRegistry& registry;
+                size_t reader;
+            };
+
+        private:
+            ModelRegistry(const ModelRegistry&);
+            ModelRegistry& operator=(const ModelRegistry&);
+
+            /// epoch announced by a reader, one per cache line
+            struct ReaderEpoch
+            {
+                ReaderEpoch();
+
+                alignas(Memory::TABLE_ALIGNMENT) std::atomic<uint64_t> epoch;
+            };
+
+            /// deletes retired versions no reader can hold, never blocks if tryOnly is set
+            void Reclaim(bool tryOnly);
+
+            size_t nmodels;
+            std::unique_ptr<std::atomic<const ServedModel*>[]> slots;
+
+            std::atomic<uint64_t> globalEpoch;
+            Memory::AlignedVector<ReaderEpoch> readerEpochs;
+
+            /// replaced versions with the epochs they were retired at
+            std::mutex retiredMutex;
+            std::vector<std::pair<uint64_t, const ServedModel*> > retired;
+            std::atomic<bool> hasRetired;
+        };
+
+        /**
+         * \brief Server settings
+         */
+        struct ServerOptions
+        {
+            /// one worker per hardware thread, other settings as of the algorithm workspaces
+            ServerOptions();
+
+            size_t nworkers;
+
+            /// limit of the estimated memory of each algorithm call and posterior reply in bytes, zero if unlimited
+            size_t memoryBudget;
+
+            Memory::PageBacking pageBacking;
+
+            uint32_t maxRequestSteps;
+        };
+
+        /**
+         * \brief Serves decode, score and posterior requests from a pool of workers
+         *
+         * \details
+         * Every worker accepts a connection and serves its requests one by one until the client
+         * closes it, so a client keeps the connection open for a sequence of requests.
+         * Each worker owns its algorithm workspace and request and reply buffers,
+         * which are reused by all requests, so short sequences are served without allocations.
+         * The algorithm variants are planned per request as for the command line decoding.
+         * Models are read from the registry once per request, the worker index is its reader index,
+         * so a model published meanwhile serves the next requests and in-flight ones are not stalled.
+         */
+        class DecodingServer
+        {
+        public:
+            /// the registry must have a reader for every worker
+            DecodingServer(ModelRegistry& models, const ServerOptions& options);
+
+            /**
+             * \brief Listens on the socket path and serves until Stop() is called
+             *
+             * \note
+             * An existing file at the socket path is replaced, the socket is removed on return.
+             * Errors of the listening socket are reported by std::system_error exceptions.
+             */
+            void Run(const std::string& socketPath);
+
+            /**
+             * \brief Stops accepting connections and closes the served ones
+             *
+             * \note
+             * Only shuts down sockets and sets a flag, so it may be called from a signal handler.
+             */
+            void Stop();
+
+            /// bytes of all worker workspaces with the given backing when the last Run returned
+            size_t WorkspaceCapacity(Memory::PageBacking backing) const;
+
+        private:
+            struct Worker;
+
+            void Serve(Worker& worker);
+            bool ServeRequest(Worker& worker, int connection);
+
+            ModelRegistry& models;
+            ServerOptions options;
+
+            std::atomic<bool> stopped;
+            std::atomic<int> listeningSocket;
+
+            /// connection of every worker, -1 if the worker waits for a connection
+            std::unique_ptr<std::atomic<int>[]> connections;
+
+            /// element[backing] is WorkspaceCapacity(backing)
+            size_t workspaceCapacity[3];
+        };
+    };
+};
+
+#endif // HMM_SERVER_H
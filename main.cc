@@ -1,12 +1,405 @@
+#include <map>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <string>
+#include <thread>
+#include <condition_variable>
+#include <csignal>
+#include <exception>
+#include <vector>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 
 #include "hmm.h"
+#include "hmm_bank.h"
+#include "hmm_output.h"
+#include "hmm_pipeline.h"
+#include "hmm_planner.h"
+#include "hmm_server.h"
+
+/// number of data files which may wait between neighbouring pipeline stages
+const size_t PIPELINE_QUEUE_CAPACITY = 4;
+
+/// confidence level of the bootstrap intervals
+const double BOOTSTRAP_CONFIDENCE = 0.95;
+
+/**
+ * \brief Optional command line settings following the model and data paths
+ */
+struct Options
+{
+    Options()
+        : outputFormat(HMM::Output::Format::Raw),
+          lumpStates(false),
+          pageBacking(HMM::Memory::PageBacking::Heap),
+          memoryBudget(0),
+          bootstrapReplicates(0),
+          calibrationBins(0),
+          curveBuckets(0),
+          evaluateSegments(false),
+          segmentTolerance(0),
+          batchThreads(0)
+    {
+    }
+
+    std::string pathOutput;
+    std::string posteriorOutput;
+    HMM::Output::Format outputFormat;
+
+    /// if set, posteriors are exported by the out-of-core algorithm using scratch files here
+    std::string scratchDirectory;
+
+    /// if set, state sequences are decoded by the model with equivalent states lumped
+    bool lumpStates;
+
+    /// preferred backing of the algorithm tables
+    HMM::Memory::PageBacking pageBacking;
+
+    /// limit of the estimated memory of each algorithm call in bytes, zero if unlimited
+    size_t memoryBudget;
+
+    /// overrides of the execution plan decisions (see ExecutionPlan::Override)
+    std::string planSettings;
+
+    /// if set, kernels are tuned on the model once per CPU model and the choice is kept here
+    std::string tuningCache;
+
+    /// number of bootstrap replicates of the estimations over all data files, zero if disabled
+    size_t bootstrapReplicates;
+
+    /// number of bins of the posterior calibration histograms, zero if disabled
+    size_t calibrationBins;
+
+    /// number of posterior buckets of the ROC and precision-recall curves, zero if disabled
+    size_t curveBuckets;
+
+    /// if set, decoded state runs are matched to the real ones within the boundary tolerance in steps
+    bool evaluateSegments;
+    size_t segmentTolerance;
+
+    /// if set, data files are decoded by the model and all these models and estimations are compared
+    std::vector<std::string> comparedModels;
+
+    /// if set, every data file is classified by the most likely of the model and these models
+    std::vector<std::string> classifyingModels;
+
+    /// number of workers of the batch and server modes, zero for the number of cores
+    size_t batchThreads;
+};
+
+/**
+ * \brief Model tables shared by all data files
+ */
+struct DecodeModels
+{
+    HMM::Data::Model model;
+    HMM::Data::CompiledModel compiledModel;
+
+    /// prepared only if states are lumped
+    HMM::Data::LumpedModel lumpedModel;
+    HMM::Data::CompiledModel compiledLumpedModel;
+
+    /// kernels measured on the decoding model, untuned without a tuning cache
+    HMM::Planning::KernelTuning tuning;
+};
+
+/**
+ * \brief Single data file passing through the parse, decode and output stages
+ */
+struct DecodeJob
+{
+    size_t index;
+    std::string dataPath;
+
+    /// non-empty if the data file could not be read
+    std::string error;
+
+    HMM::Data::ColumnarExperimentData data;
+
+    /// description of the execution plan the job was decoded with
+    std::string plan;
+
+    std::vector<size_t> mostProbableSeq;
+    HMM::Estimation::ConfusionAccumulator viterbiConfusion;
+    HMM::Estimation::ConfusionAccumulator forwardBackwardConfusion;
+
+    /// blocks of the decoded paths, filled only if bootstrap is requested
+    HMM::Estimation::BlockBootstrap viterbiBootstrap;
+    HMM::Estimation::BlockBootstrap forwardBackwardBootstrap;
+
+    /// expected confusions and calibration of the posteriors, filled only if requested
+    HMM::Estimation::PosteriorCalibration calibration;
+
+    /// ROC and precision-recall curves of the posteriors, filled only if requested
+    HMM::Estimation::ThresholdCurves curves;
+
+    /// estimations of the decoded state runs, filled only if requested
+    std::vector<HMM::Data::PredictionEstimation> viterbiSegmentEstimations;
+    std::vector<HMM::Data::PredictionEstimation> forwardBackwardSegmentEstimations;
+};
+
+/**
+ * \brief Model compared in the multi-model mode
+ *
+ * \note
+ * Data files are parsed once with the first compared model, so its state and symbol
+ * indices are mapped into the indices of every model by names.
+ */
+struct ComparedModel
+{
+    std::string path;
+    HMM::Data::Model model;
+    HMM::Data::CompiledModel compiledModel;
+
+    /// first model index to this model index, UNDEFINED_STATE if the name is absent
+    std::vector<size_t> stateMap;
+    std::vector<size_t> symbolMap;
+};
+
+/**
+ * \brief Results of one compared model for a data file
+ */
+struct ComparisonResult
+{
+    /// non-empty if the model could not decode the data file
+    std::string error;
+
+    double logLikelihood;
+    HMM::Estimation::ConfusionAccumulator viterbiConfusion;
+    HMM::Estimation::ConfusionAccumulator forwardBackwardConfusion;
+};
+
+/**
+ * \brief Single data file decoded by all compared models
+ */
+struct ComparisonJob
+{
+    size_t index;
+    std::string dataPath;
+
+    /// non-empty if the data file could not be read
+    std::string error;
+
+    HMM::Data::ColumnarExperimentData data;
+    std::vector<ComparisonResult> results;
+};
+
+/**
+ * \brief Single data file scored by the model bank
+ */
+struct ClassificationJob
+{
+    size_t index;
+    std::string dataPath;
+
+    /// non-empty if the data file could not be read or classified
+    std::string error;
+
+    HMM::Data::ColumnarExperimentData data;
+
+    std::vector<HMM::Bank::ModelScore> scores;
+    size_t bestModel;
+};
+
+/**
+ * \brief Storage of the decode stage reused for all data files
+ */
+struct DecodeBuffers
+{
+    HMM::Algorithms::Workspace workspace;
+
+    /// storage of the Viterbi algorithm running concurrently with the posterior calculation
+    HMM::Algorithms::Workspace viterbiWorkspace;
+
+    std::vector<size_t> mostProbableStates;
+};
+
+/**
+ * \brief Storage of the output stage reused for all data files
+ */
+struct OutputBuffers
+{
+    std::vector<HMM::Data::PredictionEstimation> estimations;
+    HMM::Estimation::EstimationBuffers estimationBuffers;
+};
 
 void showUsage(std::string programName)
 {
     std::cerr << "Usage: " << programName
-              << " path_to_model path_to_data " << std::endl;
+              << " path_to_model path_to_data [path_to_data ...]"
+              << " [--path-out file] [--posterior-out file] [--format raw|npy]"
+              << " [--scratch-dir directory] [--lump-states]"
+              << " [--huge-pages transparent|explicit] [--memory-budget bytes[K|M|G]]"
+              << " [--plan name=value[,name=value ...]] [--tuning-cache file] [--bootstrap replicates]"
+              << " [--calibration bins] [--curves buckets] [--segment-tolerance steps]"
+              << " [--compare-model path_to_model ...] [--classify-model path_to_model ...]"
+              << std::endl;
+    std::cerr << "       " << programName << " --batch path_to_manifest [--threads count]"
+              << " [options above except --bootstrap, --compare-model and --classify-model]"
+              << std::endl;
+    std::cerr << "       " << programName << " --serve path_to_socket path_to_model [path_to_model ...]"
+              << " [--threads count] [--memory-budget bytes[K|M|G]] [--huge-pages transparent|explicit]"
+              << std::endl;
+}
+
+/**
+ * \brief Parses byte size with optional binary K, M or G suffix
+ *
+ * \returns false if the value is malformed
+ */
+bool parseByteSize(const std::string& value, size_t& bytes)
+{
+    std::istringstream source(value);
+    unsigned long long number = 0;
+    std::string suffix;
+
+    if (! (source >> number) || (source >> suffix && suffix.size() != 1)) {
+        return false;
+    }
+
+    size_t shift = (suffix == "K" ? 10 : suffix == "M" ? 20 : suffix == "G" ? 30 : 0);
+
+    if (! suffix.empty() && shift == 0) {
+        return false;
+    }
+
+    bytes = static_cast<size_t> (number) << shift;
+
+    return true;
+}
+
+/**
+ * \brief Parses optional arguments starting from argv[firstArg]
+ *
+ * \returns false if arguments are malformed
+ */
+bool parseOptions(int argc, char* argv[], int firstArg, Options& options)
+{
+    for (int i = firstArg; i < argc; i += 2) {
+        std::string name = argv[i];
+
+        if (name == "--lump-states") {
+            options.lumpStates = true;
+            --i;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        std::string value = argv[i + 1];
+
+        if (name == "--path-out") {
+            options.pathOutput = value;
+        } else if (name == "--posterior-out") {
+            options.posteriorOutput = value;
+        } else if (name == "--scratch-dir") {
+            options.scratchDirectory = value;
+        } else if (name == "--huge-pages" && value == "transparent") {
+            options.pageBacking = HMM::Memory::PageBacking::TransparentHugePages;
+        } else if (name == "--huge-pages" && value == "explicit") {
+            options.pageBacking = HMM::Memory::PageBacking::ExplicitHugePages;
+        } else if (name == "--memory-budget") {
+            if (! parseByteSize(value, options.memoryBudget)) {
+                return false;
+            }
+        } else if (name == "--plan") {
+            // check the settings once, they are applied to the plan of every data file
+            try
+            {
+                HMM::Planning::ExecutionPlan().Override(value);
+            } catch(std::invalid_argument&) {
+                return false;
+            }
+
+            options.planSettings = value;
+        } else if (name == "--bootstrap") {
+            std::istringstream source(value);
+
+            if (! (source >> options.bootstrapReplicates) || ! source.eof()) {
+                return false;
+            }
+        } else if (name == "--compare-model") {
+            options.comparedModels.push_back(value);
+        } else if (name == "--classify-model") {
+            options.classifyingModels.push_back(value);
+        } else if (name == "--segment-tolerance") {
+            std::istringstream source(value);
+
+            if (! (source >> options.segmentTolerance) || ! source.eof()) {
+                return false;
+            }
+
+            options.evaluateSegments = true;
+        } else if (name == "--curves") {
+            std::istringstream source(value);
+
+            if (! (source >> options.curveBuckets) || ! source.eof() || options.curveBuckets == 0) {
+                return false;
+            }
+        } else if (name == "--calibration") {
+            std::istringstream source(value);
+
+            if (! (source >> options.calibrationBins) || ! source.eof() || options.calibrationBins == 0) {
+                return false;
+            }
+        } else if (name == "--threads") {
+            std::istringstream source(value);
+
+            if (! (source >> options.batchThreads) || ! source.eof() || options.batchThreads == 0) {
+                return false;
+            }
+        } else if (name == "--tuning-cache") {
+            options.tuningCache = value;
+        } else if (name == "--format" && value == "raw") {
+            options.outputFormat = HMM::Output::Format::Raw;
+        } else if (name == "--format" && value == "npy") {
+            options.outputFormat = HMM::Output::Format::Npy;
+        } else {
+            return false;
+        }
+    }
+
+    // overridden plans must be runnable with the given scratch directory
+    if (! options.planSettings.empty()) {
+        HMM::Planning::ExecutionPlan plan;
+        HMM::Planning::ExecutionEnvironment environment;
+        environment.canSpill = ! options.scratchDirectory.empty();
+        plan.Override(options.planSettings);
+
+        try
+        {
+            plan.Check(environment);
+        } catch(std::invalid_argument& e) {
+            std::cerr << "ERROR: " << e.what() << ", add --scratch-dir" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * \brief Export file name for the data file with the given index
+ *
+ * \note
+ * With several data files the index is appended to the requested name.
+ */
+std::string exportPath(const std::string& requestedPath, size_t index, size_t ndataFiles)
+{
+    if (ndataFiles == 1) {
+        return requestedPath;
+    }
+
+    std::ostringstream path;
+    path << requestedPath << '.' << index;
+
+    return path.str();
 }
 
 void printPredictionEstimation(size_t stateInd,
@@ -19,98 +412,1426 @@ void printPredictionEstimation(size_t stateInd,
               << "False Positives=" << estimation.falsePositives << ", "
               << "True Negatives=" << estimation.trueNegatives << ", "
               << "False Negatives=" << estimation.falseNegatives << ", "
+              << "precision=" << estimation.precision << ", "
+              << "recall=" << estimation.recall << ", "
               << "f-measure=" << estimation.fMeasure << '\n';
 }
 
-int main(int argc, char* argv[])
+/**
+ * \brief Prints estimations of the algorithm for all states except begin and end and over all states
+ */
+void printAlgorithmEstimations(const std::string& algorithmName,
+                               const HMM::Estimation::ConfusionAccumulator& confusion,
+                               const HMM::Data::Model& model, OutputBuffers& buffers)
 {
-    // section: check arguments and prepare input streams
-    if (argc < 3) {
-        showUsage(argv[0]);
-        return -1;
+    std::vector<HMM::Data::PredictionEstimation>& estimations = buffers.estimations;
+    HMM::Data::AggregateEstimation aggregate;
+    HMM::Estimation::GetPredictionEstimations(confusion.Matrix(), 1., estimations, aggregate,
+                                              buffers.estimationBuffers);
+
+    std::cout << algorithmName << " algorithm state prediction estimations:\n";
+
+    // skip first and last states (begin and end)
+    for (size_t i = 1; i + 1 < estimations.size(); ++i) {
+        printPredictionEstimation(i, estimations[i], model);
     }
 
-    std::ifstream modelSource(argv[1]);
-    std::ifstream dataSource(argv[2]);
+    std::cout << "All states => "
+              << "accuracy=" << aggregate.accuracy << ", "
+              << "macro f-measure=" << aggregate.macroF1 << ", "
+              << "micro f-measure=" << aggregate.microF1 << ", "
+              << "weighted f-measure=" << aggregate.weightedF1 << ", "
+              << "kappa=" << aggregate.kappa << ", "
+              << "MCC=" << aggregate.mcc << '\n';
 
-    if (! modelSource.good()) {
-        std::cerr << "ERROR: Failed to open model file properly." << std::endl;
-        return -1;
+    std::cout << "\n";
+}
+
+/**
+ * \brief Prints estimations of the decoded state runs for all states except begin and end
+ */
+void printSegmentEstimations(const std::string& algorithmName,
+                             const std::vector<HMM::Data::PredictionEstimation>& estimations,
+                             size_t tolerance, const HMM::Data::Model& model)
+{
+    std::cout << algorithmName << " algorithm state segment estimations (boundary tolerance "
+              << tolerance << " steps):\n";
+
+    // skip first and last states (begin and end)
+    for (size_t i = 1; i + 1 < estimations.size(); ++i) {
+        printPredictionEstimation(i, estimations[i], model);
     }
-    if (! dataSource.good()) {
-        std::cerr << "ERROR: Failed to open data file properly." << std::endl;
-        return -1;
+
+    std::cout << "\n";
+}
+
+/**
+ * \brief Prints expected confusions of every state and the reliability histogram over all states
+ */
+void printCalibration(const HMM::Estimation::PosteriorCalibration& calibration, const HMM::Data::Model& model)
+{
+    size_t nstates = model.transitionProb.size();
+
+    std::cout << "Forward-backward algorithm posterior-weighted state prediction estimations:\n";
+
+    // skip first and last states (begin and end)
+    for (size_t i = 1; i + 1 < nstates; ++i) {
+        double predicted = 0;
+        double real = 0;
+
+        for (size_t j = 0; j < nstates; ++j) {
+            predicted += calibration.ExpectedCount(i, j);
+            real += calibration.ExpectedCount(j, i);
+        }
+
+        std::cout << "State " << model.stateIndexToName[i] << " => "
+                  << "Expected True Positives=" << calibration.ExpectedCount(i, i) << ", "
+                  << "Expected False Positives=" << predicted - calibration.ExpectedCount(i, i) << ", "
+                  << "Expected False Negatives=" << real - calibration.ExpectedCount(i, i) << '\n';
     }
 
-    // enable exceptions to signal errors later while reading model and data
-    std::ios_base::iostate ioExcept = (std::ifstream::failbit |
-                                       std::ifstream::badbit  |
-                                       std::ifstream::eofbit);
-    modelSource.exceptions(ioExcept);
-    dataSource.exceptions(ioExcept);
+    std::cout << "\n";
+    // begin and end states never have a posterior, they would only inflate the lowest bin
+    std::cout << "Posterior calibration:\n";
 
+    size_t nbins = calibration.BinCount();
 
-    // section: read model and data
-    HMM::Data::Model model;
-    HMM::Data::ExperimentData data;
+    for (size_t b = 0; b < nbins; ++b) {
+        HMM::Estimation::PosteriorCalibration::Bin bin = calibration.PooledBin(b, 1, nstates - 1);
+
+        if (bin.count == 0) {
+            continue;
+        }
+
+        std::cout << "Posterior [" << static_cast<double> (b) / nbins << ", " << static_cast<double> (b + 1) / nbins
+                  << ") => count=" << bin.count << ", "
+                  << "mean posterior=" << bin.sumProb / bin.count << ", "
+                  << "real frequency=" << static_cast<double> (bin.positives) / bin.count << '\n';
+    }
+
+    std::cout << "Expected calibration error=" << calibration.ExpectedCalibrationError(1, nstates - 1) << "\n\n";
+}
+
+/**
+ * \brief Prints areas under ROC and precision-recall curves of the posteriors of every state
+ */
+void printCurves(const HMM::Estimation::ThresholdCurves& curves, const HMM::Data::Model& model)
+{
+    std::vector<HMM::Estimation::ThresholdCurves::StateCurves> stateCurves = curves.Curves();
+
+    std::cout << "Forward-backward algorithm posterior threshold curves:\n";
+
+    // skip first and last states (begin and end)
+    for (size_t i = 1; i + 1 < stateCurves.size(); ++i) {
+        std::cout << "State " << model.stateIndexToName[i] << " => "
+                  << "ROC AUC=" << stateCurves[i].rocAuc << ", "
+                  << "PR AUC=" << stateCurves[i].prAuc << ", "
+                  << "thresholds=" << stateCurves[i].points.size() << '\n';
+    }
+
+    std::cout << "\n";
+}
+
+/**
+ * \brief Prints bootstrap confidence intervals of the algorithm estimations
+ */
+void printBootstrapEstimations(const std::string& algorithmName,
+                               const HMM::Estimation::BlockBootstrap& bootstrap,
+                               size_t nreplicates, const HMM::Data::Model& model)
+{
+    HMM::Estimation::BootstrapEstimation estimation = bootstrap.Estimate(nreplicates, BOOTSTRAP_CONFIDENCE);
+
+    auto printInterval = [](const HMM::Estimation::ConfidenceInterval& interval)
+    {
+        std::cout << '[' << interval.lower << ", " << interval.upper << ']';
+    };
+
+    std::cout << algorithmName << " algorithm " << BOOTSTRAP_CONFIDENCE * 100 << "% confidence intervals ("
+              << nreplicates << " replicates of " << bootstrap.BlockCount() << " blocks):\n";
+
+    // skip first and last states (begin and end)
+    for (size_t i = 1; i + 1 < estimation.fMeasure.size(); ++i) {
+        std::cout << "State " << model.stateIndexToName[i] << " => precision=";
+        printInterval(estimation.precision[i]);
+        std::cout << ", recall=";
+        printInterval(estimation.recall[i]);
+        std::cout << ", f-measure=";
+        printInterval(estimation.fMeasure[i]);
+        std::cout << '\n';
+    }
+
+    std::cout << "All states => accuracy=";
+    printInterval(estimation.accuracy);
+    std::cout << ", macro f-measure=";
+    printInterval(estimation.macroF1);
+    std::cout << ", micro f-measure=";
+    printInterval(estimation.microF1);
+    std::cout << ", weighted f-measure=";
+    printInterval(estimation.weightedF1);
+    std::cout << ", kappa=";
+    printInterval(estimation.kappa);
+    std::cout << ", MCC=";
+    printInterval(estimation.mcc);
+    std::cout << "\n\n";
+}
+
+/**
+ * \brief Warns about model states and symbols pruned by the model compilation
+ *
+ * \note
+ * Begin and end states never emit symbols and are not reported.
+ */
+void reportPrunedModelParts(const HMM::Data::Model& model, const HMM::Data::CompiledModel& compiledModel)
+{
+    for (size_t i = 1; i + 1 < compiledModel.nmodelStates; ++i) {
+        switch (compiledModel.stateStatus[i]) {
+        case HMM::Data::PruneReason::NoEmissions:
+            std::cerr << "WARNING: state " << model.stateIndexToName[i] << " emits no symbols" << std::endl;
+            break;
+        case HMM::Data::PruneReason::UnreachableFromBegin:
+            std::cerr << "WARNING: state " << model.stateIndexToName[i]
+                      << " is unreachable from the begin state" << std::endl;
+            break;
+        case HMM::Data::PruneReason::CannotReachEnd:
+            std::cerr << "WARNING: state " << model.stateIndexToName[i]
+                      << " can not reach the end state" << std::endl;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < model.symbolIndexToName.size(); ++i) {
+        if (compiledModel.symbolToCompiled[i] == compiledModel.nsymbols) {
+            std::cerr << "WARNING: symbol " << model.symbolIndexToName[i]
+                      << " is emitted by pruned states only" << std::endl;
+        }
+    }
+}
+
+/**
+ * \brief Reports how the algorithm tables were backed when huge pages are requested
+ *
+ * \param capacity returns bytes of all workspaces of the mode with the given backing
+ */
+void reportPageBacking(std::function<size_t (HMM::Memory::PageBacking)> capacity)
+{
+    std::cerr << "NOTE: memory of all workspaces: "
+              << capacity(HMM::Memory::PageBacking::ExplicitHugePages) << " bytes on explicit huge pages, "
+              << capacity(HMM::Memory::PageBacking::TransparentHugePages) << " bytes on transparent huge pages, "
+              << capacity(HMM::Memory::PageBacking::Heap) << " bytes on heap" << std::endl;
+}
+
+/**
+ * \brief The same for the arenas of the workspaces
+ */
+void reportPageBacking(const std::vector<const HMM::Memory::Arena*>& arenas)
+{
+    reportPageBacking([&](HMM::Memory::PageBacking backing)
+    {
+        size_t bytes = 0;
+
+        for (size_t a = 0; a < arenas.size(); ++a) {
+            bytes += arenas[a]->Capacity(backing);
+        }
+
+        return bytes;
+    });
+}
+
+/**
+ * \brief Takes kernel tuning of the model from the cache, tunes and stores it on a miss
+ */
+void loadKernelTuning(const HMM::Data::CompiledModel& model, const Options& options,
+                      HMM::Planning::KernelTuning& tuning)
+{
+    HMM::Planning::TuningCache cache(options.tuningCache);
+    uint64_t modelHash = HMM::Planning::HashModel(model);
+    std::string cpuModel = HMM::Planning::HostCpuModel();
+
+    if (cache.Find(modelHash, cpuModel, tuning)) {
+        return;
+    }
+
+    HMM::Planning::ExecutionEnvironment environment;
+    tuning = HMM::Planning::TuneKernels(model, environment);
 
     try
     {
-        model.ReadModel(modelSource);
+        cache.Store(modelHash, cpuModel, tuning);
     } catch(std::exception& e) {
-        std::cerr << "ERROR: fatal problem while reading model. Details: '" << e.what()
-                  << "'" << std::endl;
-        return -1;
-    } catch (...) {
-        std::cerr << "ERROR: unknown exception while reading model" << std::endl;
-        return -1;
+        std::cerr << "WARNING: failed to store kernel tuning. Details: '" << e.what() << "'" << std::endl;
+    }
+}
+
+/**
+ * \brief Parse stage: reads experiment data of the job
+ */
+void readJobData(const HMM::Data::Model& model, DecodeJob& job)
+{
+    std::ifstream dataSource(job.dataPath.c_str());
+
+    if (! dataSource.good()) {
+        job.error = "ERROR: Failed to open data file properly.";
+        return;
     }
 
+    // enable exceptions to signal errors later while reading data
+    dataSource.exceptions(std::ifstream::failbit |
+                          std::ifstream::badbit  |
+                          std::ifstream::eofbit);
+
     try
     {
-        data.ReadExperimentData(model, dataSource);
+        job.data.ReadExperimentData(model, dataSource);
     } catch(std::exception& e) {
-        std::cerr << "ERROR: fatal problem while reading experiment data. Details: '" << e.what()
-                  << "'" << std::endl;
-        return -1;
+        job.error = std::string("ERROR: fatal problem while reading experiment data. Details: '") +
+                    e.what() + "'";
     } catch (...) {
-        std::cerr << "ERROR: unknown exception while reading experiment data " << std::endl;
-        return -1;
+        job.error = "ERROR: unknown exception while reading experiment data ";
     }
+}
 
-    // secton: run and estimate viterbi predictions
-    std::vector<size_t> mostProbableSeq =
-        HMM::Algorithms::FindMostProbableStateSequence(model, data);
-    std::vector<std::vector<size_t> > confusionMatrix =
-        HMM::Estimation::CombineConfusionMatrix(data, mostProbableSeq, model);
-    std::vector<HMM::Data::PredictionEstimation> estimations =
-        HMM::Estimation::GetStatePredictionEstimations(confusionMatrix);
+/**
+ * \brief Decode stage: runs and estimates both algorithms, streams posteriors if requested
+ *
+ * \details
+ * The posterior pass of the forward-backward predictions also feeds the calibration,
+ * the curves and the posterior export, so posteriors are calculated once per data file.
+ * Consumers of posteriors need the scaled streamed pass, so they replace the linear table.
+ * \note
+ * With lumped states both algorithms run over the lumped model and the decoded
+ * state sequences are expanded back into the model states. Posteriors are always
+ * computed over the model states, so then the consumers take one separate pass.
+ */
+void decodeJob(const DecodeModels& models, const Options& options,
+               size_t ndataFiles, DecodeBuffers& buffers, DecodeJob& job)
+{
+    if (! job.error.empty()) {
+        return;
+    }
 
-    std::cout << "Viterbi algorithm state prediction estimations:\n";
+    const HMM::Data::CompiledModel& model = models.compiledModel;
+    const HMM::Data::CompiledModel& decodingModel = (options.lumpStates ? models.compiledLumpedModel : model);
 
-    // skip first and last states (begin and end)
-    for (size_t i = 1; i + 1 < estimations.size(); ++i) {
-        printPredictionEstimation(i, estimations[i], model);
+    // section: columns of the experiment data
+    HMM::Data::ColumnView symbols = job.data.SymbolColumn();
+    HMM::Data::ColumnView realStates = job.data.StateColumn();
+
+    HMM::Algorithms::Workspace& workspace = buffers.workspace;
+    std::vector<size_t>& mostProbableStates = buffers.mostProbableStates;
+
+    job.viterbiConfusion.Reset(model.nmodelStates);
+    job.forwardBackwardConfusion.Reset(model.nmodelStates);
+
+    // section: plan the algorithm variants for the sequence
+    HMM::Planning::ExecutionEnvironment environment;
+    environment.memoryBudget = options.memoryBudget;
+    environment.canSpill = ! options.scratchDirectory.empty();
+
+    HMM::Planning::ExecutionPlan plan =
+        HMM::Planning::PlanExecution(decodingModel, symbols.size(), environment, models.tuning);
+
+    try
+    {
+        plan.Override(options.planSettings);
+        plan.Check(environment);
+    } catch(std::invalid_argument& e) {
+        job.error = std::string("ERROR: execution plan can not be used. Details: '") + e.what() + "'";
+        return;
     }
 
-    std::cout << "\n";
+    // section: consumers of the posterior pass
+    bool fusedPosteriors = ! options.lumpStates;
+    HMM::Algorithms::PosteriorFanout posteriorSinks;
+    std::unique_ptr<HMM::Output::PosteriorWriter> posteriorWriter;
+
+    if (options.calibrationBins != 0) {
+        job.calibration = HMM::Estimation::PosteriorCalibration(model.nmodelStates, options.calibrationBins,
+                                                                realStates);
+        posteriorSinks.Add(job.calibration);
+    }
 
-    // section: run and estimate forward-backward predictions
-    std::vector<std::vector<std::pair<double, double> > > forwardBackwardProb =
-        HMM::Algorithms::CalcForwardBackwardProbabiliies(model, data);
-    std::vector<size_t> mostProbableStates =
-        HMM::Estimation::GetMostProbableStates(forwardBackwardProb);
-    confusionMatrix = HMM::Estimation::CombineConfusionMatrix(data, mostProbableStates, model);
-    estimations = HMM::Estimation::GetStatePredictionEstimations(confusionMatrix);
+    if (options.curveBuckets != 0) {
+        job.curves = HMM::Estimation::ThresholdCurves(model.nmodelStates, options.curveBuckets, realStates);
+        posteriorSinks.Add(job.curves);
+    }
 
-    std::cout << "Forward-backward algorithm state prediction estimations:\n";
+    if (! options.posteriorOutput.empty()) {
+        try
+        {
+            posteriorWriter.reset(new HMM::Output::PosteriorWriter(
+                exportPath(options.posteriorOutput, job.index, ndataFiles), options.outputFormat,
+                job.data.Size(), model.nmodelStates));
+        } catch(std::exception& e) {
+            job.error = std::string("ERROR: failed to write results. Details: '") + e.what() + "'";
+            return;
+        }
 
-    // skip first and last states (begin and end)
-    for (size_t i = 1; i + 1 < estimations.size(); ++i) {
-        printPredictionEstimation(i, estimations[i], model);
+        posteriorSinks.Add(*posteriorWriter);
     }
 
-    std::cout << "\n";
+    bool hasPosteriorSinks = (posteriorWriter || options.calibrationBins != 0 || options.curveBuckets != 0);
+
+    if (fusedPosteriors && hasPosteriorSinks &&
+        plan.posteriorStorage == HMM::Planning::PosteriorStorage::LinearTable) {
+        plan.posteriorStorage = HMM::Planning::PosteriorStorage::ScaledStreaming;
+    }
+
+    plan.Apply(workspace);
+    plan.Apply(buffers.viterbiWorkspace);
+    job.plan = plan.Describe();
+
+    HMM::Algorithms::Workspace& viterbiWorkspace = (plan.concurrentAlgorithms ? buffers.viterbiWorkspace : workspace);
+    std::exception_ptr viterbiError;
+
+    auto viterbi = [&]()
+    {
+        try
+        {
+            if (plan.viterbiStorage == HMM::Planning::ViterbiStorage::Checkpointed) {
+                HMM::Algorithms::FindMostProbableStateSequenceCheckpointed(decodingModel, symbols, viterbiWorkspace,
+                                                                           job.mostProbableSeq);
+            } else {
+                HMM::Algorithms::FindMostProbableStateSequence(decodingModel, symbols, viterbiWorkspace,
+                                                               job.mostProbableSeq);
+            }
+        } catch(...) {
+            viterbiError = std::current_exception();
+        }
+    };
+
+    // algorithms exceeding the memory budget fail before allocating their tables
+    std::thread viterbiThread;
+
+    if (plan.concurrentAlgorithms) {
+        viterbiThread = std::thread(viterbi);
+    } else {
+        viterbi();
+    }
+
+    try
+    {
+        // section: run forward-backward predictions
+        if (plan.posteriorStorage == HMM::Planning::PosteriorStorage::LinearTable) {
+            const std::vector<std::vector<std::pair<double, double> > >& forwardBackwardProb =
+                HMM::Algorithms::CalcForwardBackwardProbabiliies(decodingModel, symbols, workspace);
+            HMM::Estimation::GetMostProbableStates(forwardBackwardProb, mostProbableStates);
+        } else {
+            // predictions are evaluated as they are streamed unless states are expanded or bootstrapped later
+            bool keepStates = (options.lumpStates || options.bootstrapReplicates != 0 || options.evaluateSegments);
+            mostProbableStates.resize(keepStates ? symbols.size() : 0);
+            HMM::Estimation::MostProbableStatesSink statesSink(mostProbableStates);
+            HMM::Estimation::ConfusionSink confusionSink(realStates, job.forwardBackwardConfusion);
+            HMM::Algorithms::PosteriorSink& statesOrConfusionSink =
+                (keepStates ? static_cast<HMM::Algorithms::PosteriorSink&> (statesSink) : confusionSink);
+            HMM::Algorithms::PosteriorFanout sink;
+
+            sink.Add(statesOrConfusionSink);
+
+            if (fusedPosteriors) {
+                sink.Add(posteriorSinks);
+            }
+
+            if (plan.posteriorStorage == HMM::Planning::PosteriorStorage::ScaledOutOfCore) {
+                HMM::Algorithms::StreamPosteriorProbabilitiesOutOfCore(decodingModel, symbols, sink, workspace,
+                                                                       options.scratchDirectory);
+            } else {
+                HMM::Algorithms::StreamPosteriorProbabilities(decodingModel, symbols, sink, workspace);
+            }
+        }
+    } catch(std::exception& e) {
+        job.error = std::string("ERROR: failed to decode data. Details: '") + e.what() + "'";
+    }
+
+    if (viterbiThread.joinable()) {
+        viterbiThread.join();
+    }
+
+    try
+    {
+        if (viterbiError) {
+            std::rethrow_exception(viterbiError);
+        }
+
+        if (! job.error.empty()) {
+            return;
+        }
+
+        // section: estimate viterbi and forward-backward predictions
+        if (options.lumpStates) {
+            job.mostProbableSeq = models.lumpedModel.ExpandStateSequence(models.model, symbols, job.mostProbableSeq);
+            mostProbableStates = models.lumpedModel.ExpandStateSequence(models.model, symbols, mostProbableStates);
+        }
+
+        job.viterbiConfusion.Add(realStates, job.mostProbableSeq);
+
+        // streamed posteriors without kept states are counted already
+        if (! mostProbableStates.empty()) {
+            job.forwardBackwardConfusion.Add(realStates, mostProbableStates);
+        }
+
+        if (options.bootstrapReplicates != 0) {
+            job.viterbiBootstrap = HMM::Estimation::BlockBootstrap(model.nmodelStates);
+            job.viterbiBootstrap.AddSequence(realStates, job.mostProbableSeq);
+            job.forwardBackwardBootstrap = HMM::Estimation::BlockBootstrap(model.nmodelStates);
+            job.forwardBackwardBootstrap.AddSequence(realStates, mostProbableStates);
+        }
+
+        if (options.evaluateSegments) {
+            std::vector<HMM::Estimation::StateSegment> realSegments;
+            std::vector<HMM::Estimation::StateSegment> predictedSegments;
+
+            HMM::Estimation::ExtractSegments(realStates, realSegments);
+            HMM::Estimation::ExtractSegments(job.mostProbableSeq, predictedSegments);
+            HMM::Estimation::GetSegmentEstimations(realSegments, predictedSegments, model.nmodelStates,
+                                                   options.segmentTolerance, job.viterbiSegmentEstimations);
+            HMM::Estimation::ExtractSegments(mostProbableStates, predictedSegments);
+            HMM::Estimation::GetSegmentEstimations(realSegments, predictedSegments, model.nmodelStates,
+                                                   options.segmentTolerance, job.forwardBackwardSegmentEstimations);
+        }
+
+        // with lumped states posteriors of the model states are consumed in one separate streamed pass
+        if (! fusedPosteriors && hasPosteriorSinks) {
+            if (! options.scratchDirectory.empty()) {
+                HMM::Algorithms::StreamPosteriorProbabilitiesOutOfCore(model, symbols, posteriorSinks, workspace,
+                                                                       options.scratchDirectory);
+            } else {
+                HMM::Algorithms::StreamPosteriorProbabilities(model, symbols, posteriorSinks, workspace);
+            }
+        }
+    } catch(std::exception& e) {
+        job.error = std::string("ERROR: failed to decode data. Details: '") + e.what() + "'";
+    }
+}
+
+/**
+ * \brief Output stage: writes decoded path and prints estimations
+ *
+ * \returns false if the job failed
+ */
+bool writeJobResults(const HMM::Data::Model& model, const Options& options,
+                     size_t ndataFiles, OutputBuffers& buffers, DecodeJob& job)
+{
+    if (ndataFiles > 1) {
+        std::cout << "Data " << job.dataPath << ":\n";
+    }
+
+    if (! job.plan.empty()) {
+        std::cout.flush();
+        std::cerr << "NOTE: execution plan for " << job.dataPath << ": " << job.plan << std::endl;
+    }
+
+    if (job.error.empty() && ! options.pathOutput.empty()) {
+        try
+        {
+            HMM::Output::PathWriter pathWriter(
+                exportPath(options.pathOutput, job.index, ndataFiles), options.outputFormat,
+                job.mostProbableSeq.size(), model.transitionProb.size());
+            pathWriter.WritePath(0, job.mostProbableSeq.size(), job.mostProbableSeq.data());
+        } catch(std::exception& e) {
+            job.error = std::string("ERROR: failed to write results. Details: '") + e.what() + "'";
+        }
+    }
+
+    if (! job.error.empty()) {
+        std::cout.flush();
+        std::cerr << job.error << std::endl;
+        return false;
+    }
+
+    printAlgorithmEstimations("Viterbi", job.viterbiConfusion, model, buffers);
+    printAlgorithmEstimations("Forward-backward", job.forwardBackwardConfusion, model, buffers);
+
+    if (options.evaluateSegments) {
+        printSegmentEstimations("Viterbi", job.viterbiSegmentEstimations, options.segmentTolerance, model);
+        printSegmentEstimations("Forward-backward", job.forwardBackwardSegmentEstimations,
+                                options.segmentTolerance, model);
+    }
+
+    if (options.calibrationBins != 0) {
+        printCalibration(job.calibration, model);
+    }
+
+    if (options.curveBuckets != 0) {
+        printCurves(job.curves, model);
+    }
+
+    return true;
+}
+
+/**
+ * \brief Reads the model reporting errors
+ *
+ * \returns false if the model could not be read
+ */
+bool readModel(const std::string& path, HMM::Data::Model& model)
+{
+    std::ifstream modelSource(path.c_str());
+
+    if (! modelSource.good()) {
+        std::cerr << "ERROR: Failed to open model file properly." << std::endl;
+        return false;
+    }
+
+    // enable exceptions to signal errors later while reading model
+    std::ios_base::iostate ioExcept = (std::ifstream::failbit |
+                                       std::ifstream::badbit  |
+                                       std::ifstream::eofbit);
+    modelSource.exceptions(ioExcept);
+
+    try
+    {
+        model.ReadModel(modelSource);
+    } catch(std::exception& e) {
+        std::cerr << "ERROR: fatal problem while reading model " << path << ". Details: '" << e.what()
+                  << "'" << std::endl;
+        return false;
+    } catch (...) {
+        std::cerr << "ERROR: unknown exception while reading model " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * \brief Reads the model and prepares its derived tables shared by all data files
+ *
+ * \returns false if the model could not be read
+ */
+bool prepareModels(const std::string& path, const Options& options, DecodeModels& models)
+{
+    const HMM::Data::Model& model = models.model;
+
+    if (! readModel(path, models.model)) {
+        return false;
+    }
+
+    models.compiledModel.Compile(model);
+    reportPrunedModelParts(model, models.compiledModel);
+
+    if (options.lumpStates) {
+        models.lumpedModel.Minimise(model);
+        models.compiledLumpedModel.Compile(models.lumpedModel.model);
+        std::cerr << "NOTE: " << model.transitionProb.size() << " model states are lumped into "
+                  << models.lumpedModel.model.transitionProb.size() << " states" << std::endl;
+    }
+
+    if (! options.tuningCache.empty()) {
+        loadKernelTuning(options.lumpStates ? models.compiledLumpedModel : models.compiledModel, options,
+                         models.tuning);
+    }
+
+    return true;
+}
+
+/**
+ * \brief Maps indices of the first model names into the model indices by names
+ */
+template <typename NameToIndex>
+std::vector<size_t> mapIndices(const std::vector<std::string>& firstIndexToName, const NameToIndex& nameToIndex)
+{
+    std::vector<size_t> indexMap(firstIndexToName.size(), HMM::Data::UNDEFINED_STATE);
+
+    for (size_t i = 0; i < firstIndexToName.size(); ++i) {
+        typename NameToIndex::const_iterator found = nameToIndex.find(firstIndexToName[i]);
+
+        if (found != nameToIndex.end()) {
+            indexMap[i] = found->second;
+        }
+    }
+
+    return indexMap;
+}
+
+/**
+ * \brief Maps the column of the first model indices into the packed column of the model indices
+ *
+ * \returns false if some index has no counterpart
+ */
+bool mapColumn(const HMM::Data::ColumnView& column, const std::vector<size_t>& indexMap, size_t maxIndex,
+               HMM::Data::PackedColumn& mapped, size_t& missingIndex)
+{
+    mapped.Reset(maxIndex);
+
+    for (size_t t = 0; t < column.size(); ++t) {
+        size_t index = indexMap[column[t]];
+
+        if (index == HMM::Data::UNDEFINED_STATE) {
+            missingIndex = column[t];
+            return false;
+        }
+
+        mapped.PushBack(index);
+    }
+
+    return true;
+}
+
+/**
+ * \brief Decode stage of the multi-model mode for one model
+ *
+ * \details
+ * The first model reads the job columns directly, other models read mapped copies.
+ * Posteriors are streamed (scaled), so they are evaluated without the posterior table.
+ */
+void decodeComparedModel(const ComparedModel& compared, const ComparedModel& first, const Options& options,
+                         const ComparisonJob& job, HMM::Algorithms::Workspace& workspace,
+                         std::vector<size_t>& mostProbableSeq, ComparisonResult& result)
+{
+    const HMM::Data::CompiledModel& model = compared.compiledModel;
+    HMM::Data::ColumnView symbols = job.data.SymbolColumn();
+    HMM::Data::ColumnView realStates = job.data.StateColumn();
+    HMM::Data::PackedColumn mappedSymbols;
+    HMM::Data::PackedColumn mappedStates;
+    size_t missingIndex = 0;
+
+    // section: columns in the model indices
+    if (&compared != &first) {
+        if (! mapColumn(symbols, compared.symbolMap, model.nmodelSymbols, mappedSymbols, missingIndex)) {
+            result.error = "symbol " + first.model.symbolIndexToName[missingIndex] + " is not in the model";
+            return;
+        }
+
+        if (! mapColumn(realStates, compared.stateMap, model.nmodelStates, mappedStates, missingIndex)) {
+            result.error = "state " + first.model.stateIndexToName[missingIndex] + " is not in the model";
+            return;
+        }
+
+        symbols = mappedSymbols.View();
+        realStates = mappedStates.View();
+    }
+
+    // section: decode and estimate
+    try
+    {
+        HMM::Planning::ExecutionEnvironment environment;
+        environment.memoryBudget = options.memoryBudget;
+        HMM::Planning::PlanExecution(model, symbols.size(), environment).Apply(workspace);
+
+        HMM::Algorithms::FindMostProbableStateSequence(model, symbols, workspace, mostProbableSeq);
+        result.viterbiConfusion.Reset(model.nmodelStates);
+        result.viterbiConfusion.Add(realStates, mostProbableSeq);
+
+        HMM::Estimation::ConfusionSink confusionSink(realStates, result.forwardBackwardConfusion);
+        result.forwardBackwardConfusion.Reset(model.nmodelStates);
+        // the posterior pass sums the forward normalisers, so no separate likelihood pass is needed
+        result.logLikelihood =
+            HMM::Algorithms::StreamPosteriorProbabilities(model, symbols, confusionSink, workspace);
+    } catch(std::exception& e) {
+        result.error = e.what();
+    }
+}
+
+/**
+ * \brief Output stage of the multi-model mode: prints estimations of all models side by side
+ *
+ * \returns false if the job or some of the models failed
+ */
+bool writeComparison(const std::vector<ComparedModel>& compared, size_t ndataFiles, const ComparisonJob& job)
+{
+    if (ndataFiles > 1) {
+        std::cout << "Data " << job.dataPath << ":\n";
+    }
+
+    if (! job.error.empty()) {
+        std::cout.flush();
+        std::cerr << job.error << std::endl;
+        return false;
+    }
+
+    bool allSucceeded = true;
+    size_t nmodels = compared.size();
+    std::vector<std::vector<HMM::Data::PredictionEstimation> > viterbiEstimations(nmodels);
+    std::vector<std::vector<HMM::Data::PredictionEstimation> > forwardBackwardEstimations(nmodels);
+    std::vector<HMM::Data::AggregateEstimation> viterbiAggregates(nmodels);
+    std::vector<HMM::Data::AggregateEstimation> forwardBackwardAggregates(nmodels);
+    HMM::Estimation::EstimationBuffers estimationBuffers;
+
+    // section: one line of totals per model
+    std::cout << "Model comparison:\n";
+
+    for (size_t m = 0; m < nmodels; ++m) {
+        const ComparisonResult& result = job.results[m];
+
+        if (! result.error.empty()) {
+            std::cout.flush();
+            std::cerr << "ERROR: model " << compared[m].path << " failed to decode data. Details: '"
+                      << result.error << "'" << std::endl;
+            allSucceeded = false;
+            continue;
+        }
+
+        HMM::Estimation::GetPredictionEstimations(result.viterbiConfusion.Matrix(), 1.,
+                                                  viterbiEstimations[m], viterbiAggregates[m], estimationBuffers);
+        HMM::Estimation::GetPredictionEstimations(result.forwardBackwardConfusion.Matrix(), 1.,
+                                                  forwardBackwardEstimations[m], forwardBackwardAggregates[m],
+                                                  estimationBuffers);
+
+        std::cout << "Model " << compared[m].path << " => "
+                  << "log-likelihood=" << result.logLikelihood << ", "
+                  << "Viterbi accuracy=" << viterbiAggregates[m].accuracy << ", "
+                  << "Viterbi macro f-measure=" << viterbiAggregates[m].macroF1 << ", "
+                  << "Forward-backward accuracy=" << forwardBackwardAggregates[m].accuracy << ", "
+                  << "Forward-backward macro f-measure=" << forwardBackwardAggregates[m].macroF1 << '\n';
+    }
+
+    // section: f-measures of every state of the first model, skip first and last states (begin and end)
+    const HMM::Data::Model& firstModel = compared[0].model;
+
+    for (size_t i = 1; i + 1 < firstModel.stateIndexToName.size(); ++i) {
+        std::cout << "State " << firstModel.stateIndexToName[i] << " f-measure =>";
+
+        for (size_t m = 0; m < nmodels; ++m) {
+            size_t state = compared[m].stateMap[i];
+
+            std::cout << (m == 0 ? " " : "; ") << compared[m].path << ": ";
+
+            if (! job.results[m].error.empty() || state == HMM::Data::UNDEFINED_STATE) {
+                std::cout << "-";
+            } else {
+                std::cout << "Viterbi=" << viterbiEstimations[m][state].fMeasure << ", "
+                          << "Forward-backward=" << forwardBackwardEstimations[m][state].fMeasure;
+            }
+        }
+
+        std::cout << '\n';
+    }
+
+    std::cout << "\n";
+
+    return allSucceeded;
+}
+
+/**
+ * \brief Reads and compiles the first model and the other models, maps the first model names into every model
+ *
+ * \returns false if some model can not be read
+ */
+bool readComparedModels(const std::string& firstModelPath, const std::vector<std::string>& otherModelPaths,
+                        std::vector<ComparedModel>& compared)
+{
+    compared.resize(otherModelPaths.size() + 1);
+
+    for (size_t m = 0; m < compared.size(); ++m) {
+        compared[m].path = (m == 0 ? firstModelPath : otherModelPaths[m - 1]);
+
+        if (! readModel(compared[m].path, compared[m].model)) {
+            return false;
+        }
+
+        compared[m].compiledModel.Compile(compared[m].model);
+        compared[m].stateMap = mapIndices(compared[0].model.stateIndexToName, compared[m].model.stateNameToIndex);
+        compared[m].symbolMap = mapIndices(compared[0].model.symbolIndexToName,
+                                           compared[m].model.symbolNameToIndex);
+    }
+
+    return true;
+}
+
+/**
+ * \brief Multi-model mode: parses every data file once and decodes it by all models concurrently
+ *
+ * \returns exit code of the program
+ */
+int compareModels(const std::string& firstModelPath, const std::vector<std::string>& dataPaths,
+                  const Options& options)
+{
+    // section: read and compile the models, map the first model names into every model
+    std::vector<ComparedModel> compared;
+
+    if (! readComparedModels(firstModelPath, options.comparedModels, compared)) {
+        return -1;
+    }
+
+    // section: parse, decode by all models and output data files in overlapping pipeline stages
+    size_t nmodels = compared.size();
+    size_t ndataFiles = dataPaths.size();
+    size_t nextJob = 0;
+    bool allSucceeded = true;
+
+    // every model decodes on its own thread with its own storage reused for all data files
+    std::vector<HMM::Algorithms::Workspace> workspaces(nmodels);
+    std::vector<std::vector<size_t> > mostProbableSeqs(nmodels);
+
+    for (size_t m = 0; m < nmodels; ++m) {
+        workspaces[m].arena.SetPageBacking(options.pageBacking);
+        workspaces[m].memoryBudget = options.memoryBudget;
+    }
+
+    HMM::Pipeline::RunThreeStagePipeline<ComparisonJob>(PIPELINE_QUEUE_CAPACITY,
+        [&]() -> std::unique_ptr<ComparisonJob>
+        {
+            if (nextJob == ndataFiles) {
+                return std::unique_ptr<ComparisonJob>();
+            }
+
+            DecodeJob parsed;
+            parsed.index = nextJob;
+            parsed.dataPath = dataPaths[nextJob++];
+            readJobData(compared[0].model, parsed);
+
+            std::unique_ptr<ComparisonJob> job(new ComparisonJob());
+            job->index = parsed.index;
+            job->dataPath = parsed.dataPath;
+            job->error = parsed.error;
+            job->data = std::move(parsed.data);
+            job->results.resize(nmodels);
+
+            return job;
+        },
+        [&](ComparisonJob& job)
+        {
+            if (! job.error.empty()) {
+                return;
+            }
+
+            std::vector<std::thread> threads;
+
+            for (size_t m = 1; m < nmodels; ++m) {
+                threads.push_back(std::thread(decodeComparedModel, std::cref(compared[m]), std::cref(compared[0]),
+                                              std::cref(options), std::cref(job), std::ref(workspaces[m]),
+                                              std::ref(mostProbableSeqs[m]), std::ref(job.results[m])));
+            }
+
+            decodeComparedModel(compared[0], compared[0], options, job, workspaces[0], mostProbableSeqs[0],
+                                job.results[0]);
+
+            for (size_t i = 0; i < threads.size(); ++i) {
+                threads[i].join();
+            }
+        },
+        [&](ComparisonJob& job) { allSucceeded = writeComparison(compared, ndataFiles, job) && allSucceeded; });
+
+    if (options.pageBacking != HMM::Memory::PageBacking::Heap) {
+        std::vector<const HMM::Memory::Arena*> arenas;
+
+        for (size_t m = 0; m < nmodels; ++m) {
+            arenas.push_back(&workspaces[m].arena);
+        }
+
+        reportPageBacking(arenas);
+    }
+
+    return (allSucceeded ? 0 : -1);
+}
+
+/**
+ * \brief Output stage of the classification mode: prints the most likely model and all scores
+ *
+ * \returns false if the job failed
+ */
+bool writeClassification(const std::vector<ComparedModel>& classifying, size_t ndataFiles,
+                         const ClassificationJob& job)
+{
+    if (ndataFiles > 1) {
+        std::cout << "Data " << job.dataPath << ":\n";
+    }
+
+    if (! job.error.empty()) {
+        std::cout.flush();
+        std::cerr << job.error << std::endl;
+        return false;
+    }
+
+    if (job.bestModel == job.scores.size()) {
+        std::cout << "Classification => no model can emit the data\n";
+    } else {
+        std::cout << "Classification => model=" << classifying[job.bestModel].path << ", "
+                  << "log-likelihood=" << job.scores[job.bestModel].logLikelihood << '\n';
+    }
+
+    // terminated models report the bound which was already below the best log-likelihood
+    for (size_t m = 0; m < classifying.size(); ++m) {
+        std::cout << "Model " << classifying[m].path << " => "
+                  << (job.scores[m].terminated ? "log-likelihood bound=" : "log-likelihood=")
+                  << job.scores[m].logLikelihood << '\n';
+    }
+
+    std::cout << "\n";
+
+    return true;
+}
+
+/**
+ * \brief Classification mode: scores every data file by the bank of all models and picks the most likely one
+ *
+ * \returns exit code of the program
+ */
+int classifyByModels(const std::string& firstModelPath, const std::vector<std::string>& dataPaths,
+                     const Options& options)
+{
+    // section: read the models into the bank over the first model symbols
+    std::vector<ComparedModel> classifying;
+
+    if (! readComparedModels(firstModelPath, options.classifyingModels, classifying)) {
+        return -1;
+    }
+
+    HMM::Bank::ModelBank bank(classifying[0].model.symbolIndexToName.size());
+
+    for (size_t m = 0; m < classifying.size(); ++m) {
+        bank.Add(classifying[m].compiledModel, classifying[m].symbolMap);
+    }
+
+    // section: parse, classify and output data files in overlapping pipeline stages
+    size_t ndataFiles = dataPaths.size();
+    size_t nextJob = 0;
+    bool allSucceeded = true;
+
+    HMM::Pipeline::RunThreeStagePipeline<ClassificationJob>(PIPELINE_QUEUE_CAPACITY,
+        [&]() -> std::unique_ptr<ClassificationJob>
+        {
+            if (nextJob == ndataFiles) {
+                return std::unique_ptr<ClassificationJob>();
+            }
+
+            DecodeJob parsed;
+            parsed.index = nextJob;
+            parsed.dataPath = dataPaths[nextJob++];
+            readJobData(classifying[0].model, parsed);
+
+            std::unique_ptr<ClassificationJob> job(new ClassificationJob());
+            job->index = parsed.index;
+            job->dataPath = parsed.dataPath;
+            job->error = parsed.error;
+            job->data = std::move(parsed.data);
+
+            return job;
+        },
+        [&](ClassificationJob& job)
+        {
+            if (job.error.empty()) {
+                job.bestModel = bank.Classify(job.data.SymbolColumn(), job.scores);
+            }
+        },
+        [&](ClassificationJob& job) { allSucceeded = writeClassification(classifying, ndataFiles, job) && allSucceeded; });
+
+    return (allSucceeded ? 0 : -1);
+}
+
+/**
+ * \brief Reads the batch manifest: one job per line as the model path and the data path
+ *
+ * \note
+ * Paths are separated by whitespace, empty lines and lines starting with '#' are skipped.
+ *
+ * \returns false if the manifest can not be read or some line is malformed
+ */
+bool readManifest(const std::string& path, std::vector<std::pair<std::string, std::string> >& jobs)
+{
+    std::ifstream source(path.c_str());
+
+    if (! source.good()) {
+        std::cerr << "ERROR: Failed to open manifest file properly." << std::endl;
+        return false;
+    }
+
+    std::string line;
+
+    for (size_t lineNumber = 1; std::getline(source, line); ++lineNumber) {
+        std::istringstream fields(line);
+        std::string modelPath;
+        std::string dataPath;
+        std::string extra;
+
+        if (! (fields >> modelPath) || modelPath[0] == '#') {
+            continue;
+        }
+
+        if (! (fields >> dataPath) || fields >> extra) {
+            std::cerr << "ERROR: manifest line " << lineNumber << " is not a model path and a data path"
+                      << std::endl;
+            return false;
+        }
+
+        jobs.push_back(std::make_pair(modelPath, dataPath));
+    }
+
+    return true;
+}
+
+/**
+ * \brief Batch mode: runs (model, data) jobs of the manifest on a fixed pool of workers
+ *
+ * \details
+ * Every distinct model is read and compiled once and shared by all its jobs.
+ * Each worker owns its decode storage, takes the next job, parses and decodes it.
+ * Results are written per job in the manifest order as soon as the job and all
+ * previous ones are finished, exports get the job index appended.
+ *
+ * \returns exit code of the program
+ */
+int runBatch(const std::string& manifestPath, const Options& options)
+{
+    std::vector<std::pair<std::string, std::string> > manifest;
+
+    if (! readManifest(manifestPath, manifest)) {
+        return -1;
+    }
+
+    // section: read and prepare every distinct model once
+    std::map<std::string, std::unique_ptr<DecodeModels> > models;
+    bool allSucceeded = true;
+
+    for (size_t j = 0; j < manifest.size(); ++j) {
+        std::unique_ptr<DecodeModels>& jobModels = models[manifest[j].first];
+
+        if (jobModels) {
+            continue;
+        }
+
+        jobModels.reset(new DecodeModels());
+
+        if (! prepareModels(manifest[j].first, options, *jobModels)) {
+            allSucceeded = false;
+        }
+    }
+
+    if (! allSucceeded) {
+        return -1;
+    }
+
+    // section: workers decode jobs, finished jobs wait here for their turn to be written
+    size_t njobs = manifest.size();
+    size_t nthreads = options.batchThreads;
+
+    if (nthreads == 0) {
+        nthreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+
+    nthreads = std::min(nthreads, std::max(njobs, static_cast<size_t> (1)));
+
+    std::vector<std::unique_ptr<DecodeJob> > finishedJobs(njobs);
+    std::atomic<size_t> nextJob(0);
+    std::mutex finishedMutex;
+    std::condition_variable jobFinished;
+
+    // every worker owns its decode storage, kept until the memory report
+    std::vector<DecodeBuffers> workerBuffers(nthreads);
+
+    auto worker = [&](size_t w)
+    {
+        DecodeBuffers& buffers = workerBuffers[w];
+        buffers.workspace.arena.SetPageBacking(options.pageBacking);
+        buffers.workspace.memoryBudget = options.memoryBudget;
+        buffers.viterbiWorkspace.arena.SetPageBacking(options.pageBacking);
+        buffers.viterbiWorkspace.memoryBudget = options.memoryBudget;
+
+        for (size_t j = nextJob++; j < njobs; j = nextJob++) {
+            const DecodeModels& jobModels = *models.find(manifest[j].first)->second;
+            std::unique_ptr<DecodeJob> job(new DecodeJob());
+            job->index = j;
+            job->dataPath = manifest[j].second;
+            readJobData(jobModels.model, *job);
+            decodeJob(jobModels, options, njobs, buffers, *job);
+
+            std::lock_guard<std::mutex> lock(finishedMutex);
+            finishedJobs[j] = std::move(job);
+            jobFinished.notify_one();
+        }
+    };
+
+    std::vector<std::thread> workers;
+
+    for (size_t w = 0; w < nthreads; ++w) {
+        workers.push_back(std::thread(worker, w));
+    }
+
+    // section: write results in the manifest order, releasing every job once written
+    OutputBuffers outputBuffers;
+
+    for (size_t j = 0; j < njobs; ++j) {
+        std::unique_ptr<DecodeJob> job;
+
+        {
+            std::unique_lock<std::mutex> lock(finishedMutex);
+            jobFinished.wait(lock, [&]() { return static_cast<bool> (finishedJobs[j]); });
+            job = std::move(finishedJobs[j]);
+        }
+
+        if (njobs > 1) {
+            std::cout << "Model " << manifest[j].first << ":\n";
+        }
+
+        const HMM::Data::Model& model = models.find(manifest[j].first)->second->model;
+        allSucceeded = writeJobResults(model, options, njobs, outputBuffers, *job) && allSucceeded;
+    }
+
+    for (size_t w = 0; w < workers.size(); ++w) {
+        workers[w].join();
+    }
+
+    if (options.pageBacking != HMM::Memory::PageBacking::Heap) {
+        std::vector<const HMM::Memory::Arena*> arenas;
+
+        for (size_t w = 0; w < nthreads; ++w) {
+            arenas.push_back(&workerBuffers[w].workspace.arena);
+            arenas.push_back(&workerBuffers[w].viterbiWorkspace.arena);
+        }
+
+        reportPageBacking(arenas);
+    }
+
+    return (allSucceeded ? 0 : -1);
+}
+
+/**
+ * \brief Reads and compiles the model to be served
+ *
+ * \returns false if the model could not be read
+ */
+bool readServedModel(const std::string& path, HMM::Server::ServedModel& served)
+{
+    served.name = path;
+
+    if (! readModel(path, served.model)) {
+        return false;
+    }
+
+    served.compiledModel.Compile(served.model);
+
+    return true;
+}
+
+/**
+ * \brief Server mode: serves the models over the Unix socket until interrupted
+ *
+ * \details
+ * Models are addressed by their order on the command line, starting from zero.
+ * SIGHUP reloads all model files and publishes new versions, requests in flight
+ * finish with the old versions; a model which fails to load keeps its served version.
+ * SIGINT and SIGTERM stop the server. Signals are taken by a dedicated thread,
+ * so reloading never runs in a signal handler.
+ *
+ * \returns exit code of the program
+ */
+int serveModels(const std::string& socketPath, const std::vector<std::string>& modelPaths, const Options& options)
+{
+    HMM::Server::ServerOptions serverOptions;
+    serverOptions.memoryBudget = options.memoryBudget;
+    serverOptions.pageBacking = options.pageBacking;
+
+    if (options.batchThreads != 0) {
+        serverOptions.nworkers = options.batchThreads;
+    }
+
+    // section: first versions of the models
+    HMM::Server::ModelRegistry registry(modelPaths.size(), serverOptions.nworkers);
+
+    for (size_t m = 0; m < modelPaths.size(); ++m) {
+        std::unique_ptr<HMM::Server::ServedModel> served(new HMM::Server::ServedModel());
+
+        if (! readServedModel(modelPaths[m], *served)) {
+            return -1;
+        }
+
+        registry.Publish(m, std::move(served));
+    }
+
+    // section: signals are blocked in all threads and taken by the signal thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    HMM::Server::DecodingServer server(registry, serverOptions);
+
+    std::thread signalThread([&]()
+    {
+        int signal = 0;
+
+        while (sigwait(&signals, &signal) == 0 && signal == SIGHUP) {
+            for (size_t m = 0; m < modelPaths.size(); ++m) {
+                std::unique_ptr<HMM::Server::ServedModel> served(new HMM::Server::ServedModel());
+
+                if (readServedModel(modelPaths[m], *served)) {
+                    registry.Publish(m, std::move(served));
+                    std::cerr << "NOTE: model " << modelPaths[m] << " is reloaded" << std::endl;
+                } else {
+                    std::cerr << "ERROR: model " << modelPaths[m] << " keeps the served version" << std::endl;
+                }
+            }
+        }
+
+        server.Stop();
+    });
+
+    int exitCode = 0;
+
+    try
+    {
+        std::cerr << "NOTE: serving " << modelPaths.size() << " models on " << socketPath << " by "
+                  << serverOptions.nworkers << " workers" << std::endl;
+        server.Run(socketPath);
+
+        if (options.pageBacking != HMM::Memory::PageBacking::Heap) {
+            reportPageBacking([&](HMM::Memory::PageBacking backing) { return server.WorkspaceCapacity(backing); });
+        }
+    } catch(std::exception& e) {
+        std::cerr << "ERROR: server failed. Details: '" << e.what() << "'" << std::endl;
+        exitCode = -1;
+    }
+
+    // the signal thread may still wait if the server failed
+    pthread_kill(signalThread.native_handle(), SIGTERM);
+    signalThread.join();
+
+    return exitCode;
+}
+
+int main(int argc, char* argv[])
+{
+    // section: check arguments and prepare model input stream
+    Options options;
+
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        if (argc < 3 || ! parseOptions(argc, argv, 3, options)) {
+            showUsage(argv[0]);
+            return -1;
+        }
+
+        // jobs are reported one by one, so estimations over all jobs and other modes do not apply
+        if (options.bootstrapReplicates != 0 || ! options.comparedModels.empty() ||
+            ! options.classifyingModels.empty()) {
+            std::cerr << "ERROR: --bootstrap, --compare-model and --classify-model are not supported in batch mode"
+                      << std::endl;
+            showUsage(argv[0]);
+            return -1;
+        }
+
+        return runBatch(argv[2], options);
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--serve") {
+        std::vector<std::string> modelPaths;
+        int firstServeOption = 3;
+
+        for (; firstServeOption < argc && std::string(argv[firstServeOption]).compare(0, 2, "--") != 0;
+             ++firstServeOption) {
+            modelPaths.push_back(argv[firstServeOption]);
+        }
+
+        if (modelPaths.empty() || ! parseOptions(argc, argv, firstServeOption, options)) {
+            showUsage(argv[0]);
+            return -1;
+        }
+
+        return serveModels(argv[2], modelPaths, options);
+    }
+
+    std::vector<std::string> dataPaths;
+    int firstOption = 2;
+
+    for (; firstOption < argc && std::string(argv[firstOption]).compare(0, 2, "--") != 0; ++firstOption) {
+        dataPaths.push_back(argv[firstOption]);
+    }
+
+    if (dataPaths.empty() || ! parseOptions(argc, argv, firstOption, options)) {
+        showUsage(argv[0]);
+        return -1;
+    }
+
+    if (! options.comparedModels.empty()) {
+        return compareModels(argv[1], dataPaths, options);
+    }
+
+    if (! options.classifyingModels.empty()) {
+        return classifyByModels(argv[1], dataPaths, options);
+    }
+
+    // section: read model and prepare derived model tables once for all data files
+    DecodeModels models;
+    const HMM::Data::Model& model = models.model;
+
+    if (! prepareModels(argv[1], options, models)) {
+        return -1;
+    }
+
+    // section: parse, decode and output data files in overlapping pipeline stages
+    size_t ndataFiles = dataPaths.size();
+    size_t nextJob = 0;
+    bool allSucceeded = true;
+
+    // confusions of all data files, merged in the output stage
+    HMM::Estimation::ConfusionAccumulator viterbiTotal(model.transitionProb.size());
+    HMM::Estimation::ConfusionAccumulator forwardBackwardTotal(model.transitionProb.size());
+    HMM::Estimation::PosteriorCalibration calibrationTotal(model.transitionProb.size(), options.calibrationBins);
+    HMM::Estimation::ThresholdCurves curvesTotal(model.transitionProb.size(), options.curveBuckets);
+    HMM::Estimation::BlockBootstrap viterbiBootstrap(model.transitionProb.size());
+    HMM::Estimation::BlockBootstrap forwardBackwardBootstrap(model.transitionProb.size());
+
+    // decode and output stages run on single threads and reuse their storage for all data files
+    DecodeBuffers buffers;
+    OutputBuffers outputBuffers;
+    buffers.workspace.arena.SetPageBacking(options.pageBacking);
+    buffers.workspace.memoryBudget = options.memoryBudget;
+    buffers.viterbiWorkspace.arena.SetPageBacking(options.pageBacking);
+    buffers.viterbiWorkspace.memoryBudget = options.memoryBudget;
+
+    HMM::Pipeline::RunThreeStagePipeline<DecodeJob>(PIPELINE_QUEUE_CAPACITY,
+        [&]() -> std::unique_ptr<DecodeJob>
+        {
+            if (nextJob == ndataFiles) {
+                return std::unique_ptr<DecodeJob>();
+            }
+
+            std::unique_ptr<DecodeJob> job(new DecodeJob());
+            job->index = nextJob;
+            job->dataPath = dataPaths[nextJob++];
+            readJobData(model, *job);
+
+            return job;
+        },
+        [&](DecodeJob& job) { decodeJob(models, options, ndataFiles, buffers, job); },
+        [&](DecodeJob& job)
+        {
+            if (writeJobResults(model, options, ndataFiles, outputBuffers, job)) {
+                viterbiTotal.Merge(job.viterbiConfusion);
+                forwardBackwardTotal.Merge(job.forwardBackwardConfusion);
+
+                if (options.calibrationBins != 0) {
+                    calibrationTotal.Merge(job.calibration);
+                }
+
+                if (options.curveBuckets != 0) {
+                    curvesTotal.Merge(job.curves);
+                }
+
+                if (options.bootstrapReplicates != 0) {
+                    viterbiBootstrap.Merge(job.viterbiBootstrap);
+                    forwardBackwardBootstrap.Merge(job.forwardBackwardBootstrap);
+                }
+            } else {
+                allSucceeded = false;
+            }
+        });
+
+    if (ndataFiles > 1) {
+        std::cout << "All data:\n";
+        printAlgorithmEstimations("Viterbi", viterbiTotal, model, outputBuffers);
+        printAlgorithmEstimations("Forward-backward", forwardBackwardTotal, model, outputBuffers);
+
+        if (options.calibrationBins != 0) {
+            printCalibration(calibrationTotal, model);
+        }
+
+        if (options.curveBuckets != 0) {
+            printCurves(curvesTotal, model);
+        }
+    }
+
+    if (options.bootstrapReplicates != 0 && viterbiBootstrap.BlockCount() != 0) {
+        printBootstrapEstimations("Viterbi", viterbiBootstrap, options.bootstrapReplicates, model);
+        printBootstrapEstimations("Forward-backward", forwardBackwardBootstrap, options.bootstrapReplicates, model);
+    }
+
+    if (options.pageBacking != HMM::Memory::PageBacking::Heap) {
+        reportPageBacking({&buffers.workspace.arena, &buffers.viterbiWorkspace.arena});
+    }
 
-    return 0;
+    return (allSucceeded ? 0 : -1);
 }
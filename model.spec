@@ -5,7 +5,11 @@
      there must be no transitions to the starting state and from the ending state;
      there must be at least two states: begin and end)
 >
-<number of different possible symbols (a..z, no more than 26)>
+<number of different possible symbols
+    (symbols are arbitrary whitespace-free tokens, they are dictionary-encoded
+     in order of first appearance in the emissions list;
+     number of different emitted symbols must not exceed this value)
+>
 <number of transitions>
 <state transitions as space delimited one-per-line triples "from to probability"; unmentioned will have zero probability>
 <number of state-symbol emission probablities>
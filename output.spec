@@ -0,0 +1,52 @@
+<binary array files written by --path-out and --posterior-out options>
+
+<raw format (--format raw, default), all values are little-endian:
+    8 bytes   - magic "HMMARRAY"
+    1 byte    - element type: 'u' for unsigned integer, 'f' for floating point
+    1 byte    - element size in bytes
+    2 bytes   - number of dimensions
+    8 bytes   - size of each dimension, one per dimension
+    remaining - array elements in row-major order
+>
+
+<npy format (--format npy): numpy .npy version 1.0 file with the same elements>
+
+<decoded path: one-dimensional array of nsteps state indices
+    (index of the state in the model states list, starting from zero),
+    elements are the narrowest unsigned type (1, 2, 4 or 8 bytes) able to hold any state index
+>
+
+<posteriors: two-dimensional nsteps x nstates array of 8-byte floating point numbers,
+    element [t][i] is the probability of the i-th state at step t given all observations
+>
+
+<tuning cache (--tuning-cache option): text file of kernel tunings appended by the program,
+    one tuning per line of three tab separated fields:
+    model hash (16 hex digits), CPU model name, kernel=auto|dense|sparse,passes=sequential|parallel
+>
+
+<server protocol (--serve mode): requests and replies over a Unix domain stream socket,
+    all fields in the native byte order of the host; a client may send any number of requests
+    over one connection, every request gets one reply in order:
+    request:
+        4 bytes   - magic "HMMQ"
+        1 byte    - kind: 1 decode (most probable states), 2 score (log-likelihood), 3 posteriors
+        3 bytes   - reserved, zero
+        4 bytes   - model index, the order of the models on the command line starting from zero
+        4 bytes   - nsteps, number of symbols
+        remaining - nsteps 4-byte symbol indices (index of the symbol in the model symbols list)
+    reply:
+        4 bytes   - status: 0 success, 1 error
+        4 bytes   - nrows
+        4 bytes   - ncols
+        4 bytes   - element size in bytes
+        remaining - nrows x ncols elements in row-major order:
+                    decode: nsteps x 1 4-byte unsigned state indices,
+                    score: 1 x 1 8-byte floating point log-likelihood,
+                    posteriors: nsteps x nstates 8-byte floating point probabilities,
+                    error: message of nrows x 1 1-byte characters
+    a request with a malformed magic or a sequence longer than the server limit
+    gets an error reply and the connection is closed;
+    with --memory-budget a request whose algorithm and reply (the whole posterior table)
+    are estimated to exceed the budget gets an error reply
+>